@@ -0,0 +1,717 @@
+/*
+ * dlfb_core.c -- pixel work of udlfb that needs no device
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ *
+ * Everything here works on buffers it is handed, see dlfb_core.h. Keep it
+ * that way: no locks, no allocation, nothing from the device, and only the
+ * few helpers below from the kernel, so it still builds in userspace.
+ */
+
+#ifdef __KERNEL__
+#include <linux/prefetch.h>
+#endif
+#include "dlfb_core.h"
+
+#ifndef __KERNEL__
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min_t(type, a, b)	min((type) (a), (type) (b))
+#define max_t(type, a, b)	max((type) (a), (type) (b))
+#define IS_ALIGNED(x, a)	(((x) & ((a) - 1)) == 0)
+#define BITS_PER_LONG		(8 * sizeof(long))
+#define DIV_ROUND_UP_ULL(n, d)	(((n) + (d) - 1) / (d))
+#define prefetch(p)		__builtin_prefetch(p)
+#endif
+
+static bool dlfb_area_touches(const struct dloarea *a,
+			      const struct dloarea *b)
+{
+	return (a->x <= b->x2) && (b->x <= a->x2) &&
+	       (a->y <= b->y2) && (b->y <= a->y2);
+}
+
+static void dlfb_area_union(struct dloarea *a, const struct dloarea *b)
+{
+	a->x = min(a->x, b->x);
+	a->y = min(a->y, b->y);
+	a->x2 = max(a->x2, b->x2);
+	a->y2 = max(a->y2, b->y2);
+	a->w = a->x2 - a->x;
+	a->h = a->y2 - a->y;
+}
+
+/*
+ * Add an area to a short list, merging it with every entry it overlaps
+ * or touches as long as the bounding box wastes little. When the list is
+ * full, the area is folded into the entry that grows least.
+ */
+void dlfb_merge_area(struct dloarea *areas, int *count, int max_count,
+		     struct dloarea area)
+{
+	struct dloarea merged;
+	int best = 0;
+	int best_growth = INT_MAX;
+	int i = 0;
+
+	while (i < *count) {
+		merged = areas[i];
+		dlfb_area_union(&merged, &area);
+
+		if (dlfb_area_touches(&areas[i], &area) &&
+		    (merged.w * merged.h * 4 <=
+		     (areas[i].w * areas[i].h + area.w * area.h) * 5)) {
+			/* take the entry out and retry with the union */
+			areas[i] = areas[--(*count)];
+			area = merged;
+			i = 0;
+		} else
+			i++;
+	}
+
+	if (*count < max_count) {
+		areas[(*count)++] = area;
+		return;
+	}
+
+	for (i = 0; i < *count; i++) {
+		int growth;
+
+		merged = areas[i];
+		dlfb_area_union(&merged, &area);
+		growth = merged.w * merged.h - areas[i].w * areas[i].h;
+		if (growth < best_growth) {
+			best_growth = growth;
+			best = i;
+		}
+	}
+	dlfb_area_union(&areas[best], &area);
+}
+
+/*
+ * Trim identical bytes from front and back of line
+ * Sets new front buffer address and width
+ * And returns byte count of identical pixels
+ * Assumes CPU natural alignment (unsigned long)
+ * for back and front buffer ptrs and width
+ */
+int dlfb_trim_hline(const u8 *bback, const u8 **bfront, int *width_bytes)
+{
+	int j, k;
+	const unsigned long *back = (const unsigned long *) bback;
+	const unsigned long *front = (const unsigned long *) *bfront;
+	const int width = *width_bytes / sizeof(unsigned long);
+	int identical = width;
+	int start = width;
+	int end = width;
+
+	prefetch((void *) front);
+	prefetch((void *) back);
+
+	/*
+	 * Most of a damaged span is usually unchanged, so skip over it a
+	 * block of words at a time. OR-ing the XORs keeps the inner loop
+	 * free of branches until a block actually differs.
+	 */
+	for (j = 0; j + TRIM_BLOCK_WORDS <= width; j += TRIM_BLOCK_WORDS) {
+		if ((back[j] ^ front[j]) | (back[j+1] ^ front[j+1]) |
+		    (back[j+2] ^ front[j+2]) | (back[j+3] ^ front[j+3]))
+			break;
+	}
+	for (; j < width; j++) {
+		if (back[j] != front[j])
+			break;
+	}
+
+	if (j < width) {
+		start = j;
+
+		/* back[start] differs, so both scans stop at start + 1 */
+		for (k = width; k - TRIM_BLOCK_WORDS > start;
+		     k -= TRIM_BLOCK_WORDS) {
+			if ((back[k-1] ^ front[k-1]) | (back[k-2] ^ front[k-2]) |
+			    (back[k-3] ^ front[k-3]) | (back[k-4] ^ front[k-4]))
+				break;
+		}
+		for (; k > start; k--) {
+			if (back[k-1] != front[k-1])
+				break;
+		}
+		end = k;
+	}
+
+	identical = start + (width - end);
+	*bfront = (u8 *) &front[start];
+	*width_bytes = (end - start) * sizeof(unsigned long);
+
+	return identical * sizeof(unsigned long);
+}
+
+/* dst = a ^ b, a word at a time when all three are aligned */
+void dlfb_xor_pixels(void *dst, const void *a, const void *b, u32 pixels)
+{
+	u8 *d = dst;
+	const u8 *x = a, *y = b;
+	u32 bytes = pixels * BPP;
+
+	if (IS_ALIGNED((unsigned long) d | (unsigned long) x |
+		       (unsigned long) y, sizeof(unsigned long))) {
+		while (bytes >= sizeof(unsigned long)) {
+			*(unsigned long *) d = *(const unsigned long *) x ^
+				*(const unsigned long *) y;
+			d += sizeof(unsigned long);
+			x += sizeof(unsigned long);
+			y += sizeof(unsigned long);
+			bytes -= sizeof(unsigned long);
+		}
+	}
+
+	while (bytes--)
+		*d++ = *x++ ^ *y++;
+}
+
+/*
+ * Unsigned LEB128: 7 bits per byte, low bits first, high bit set on
+ * every byte but the last. Offsets and lengths of batched segments are
+ * mostly small, so this keeps their headers to a few bytes.
+ */
+char *dlfb_put_varint(char *buf, u32 value)
+{
+	while (value >= 0x80) {
+		*buf++ = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	*buf++ = value;
+	return buf;
+}
+
+/*
+ * LEB128 padded out to bytes with continuation bits, for a length that
+ * is only known after the data behind it has been written.
+ */
+void dlfb_put_varint_fixed(char *buf, u32 value, int bytes)
+{
+	while (--bytes) {
+		*buf++ = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	*buf = value & 0x7F;
+}
+
+/*
+ * Run detection looks at RLE_SCAN_PIXELS pixels per step, as a few
+ * machine words, and only falls back to single pixels around a
+ * boundary. It is plain C, so it needs no FPU or NEON state saved on
+ * the way into the encoder and runs the same on every architecture.
+ */
+#define RLE_SCAN_WORDS (RLE_SCAN_BYTES / sizeof(unsigned long))
+#define PIXEL_PATTERN (~0UL / 0xFFFF) /* 0x0001 in every pixel lane */
+
+/* Pixels from pixel on equal to it, up to max */
+static u32 dlfb_rle_run(const u16 *pixel, u32 max)
+{
+	const u16 value = *pixel;
+	const unsigned long pattern = value * PIXEL_PATTERN;
+	u32 run = 1;
+
+	while ((run < max) &&
+	       !IS_ALIGNED((unsigned long) (pixel + run),
+			   sizeof(unsigned long))) {
+		if (pixel[run] != value)
+			return run;
+		run++;
+	}
+
+	while (run + RLE_SCAN_PIXELS <= max) {
+		const unsigned long *word = (const unsigned long *)
+			(pixel + run);
+		unsigned long diff = 0;
+		int i;
+
+		for (i = 0; i < RLE_SCAN_WORDS; i++)
+			diff |= word[i] ^ pattern;
+		if (diff)
+			break;
+		run += RLE_SCAN_PIXELS;
+	}
+
+	while ((run < max) && (pixel[run] == value))
+		run++;
+
+	return run;
+}
+
+/*
+ * Whether any of the aligned block of RLE_SCAN_PIXELS pixels equals
+ * the pixel after it. Each word is compared with itself moved along by
+ * one pixel, and a zero pixel lane in the difference is a match.
+ */
+static bool dlfb_rle_block_has_pair(const u16 *pixel)
+{
+	const unsigned long *word = (const unsigned long *) pixel;
+	const unsigned long high = PIXEL_PATTERN << 15;
+	unsigned long found = 0;
+	int i;
+
+	for (i = 0; i < RLE_SCAN_WORDS; i++) {
+		const unsigned long next = (i + 1 < RLE_SCAN_WORDS) ?
+			word[i + 1] : pixel[RLE_SCAN_PIXELS];
+		unsigned long diff;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		diff = word[i] ^ ((word[i] << 16) |
+			(i + 1 < RLE_SCAN_WORDS ?
+			 next >> (BITS_PER_LONG - 16) : next));
+#else
+		diff = word[i] ^ ((word[i] >> 16) |
+				  (next << (BITS_PER_LONG - 16)));
+#endif
+		found |= (diff - PIXEL_PATTERN) & ~diff & high;
+	}
+
+	return found;
+}
+
+/*
+ * Pixels from pixel on that aren't the start of a run of RLE_MIN_RUN,
+ * up to avail. The first one is known not to be.
+ */
+static u32 dlfb_rle_literals(const u16 *pixel, u32 avail)
+{
+	u32 n = 1;
+
+	while (n + RLE_MIN_RUN <= avail) {
+		/* skip whole blocks with no two neighbours equal */
+		if (IS_ALIGNED((unsigned long) (pixel + n),
+			       sizeof(unsigned long)) &&
+		    (n + RLE_SCAN_PIXELS + 1 <= avail) &&
+		    !dlfb_rle_block_has_pair(pixel + n)) {
+			n += RLE_SCAN_PIXELS;
+			continue;
+		}
+		if ((pixel[n] == pixel[n + 1]) && (pixel[n] == pixel[n + 2]))
+			return n;
+		n++;
+	}
+
+	return avail;
+}
+
+/*
+ * RLE version 1, see documentation/compression.txt. Every opcode byte
+ * says what follows and for how many pixels (count - 1 in the low 7
+ * bits): with RLE_RUN set, one pixel repeated; otherwise that many
+ * literal pixels. Runs shorter than RLE_MIN_RUN go into a literal, but
+ * a run of two is still cheaper as a run when no literal is open.
+ * Encodes from src into dst until either runs out; *pixels is how many
+ * to encode on entry and how many were on return.
+ */
+char *dlfb_rle_encode(char *dst, const char *dst_end,
+		      const u16 *src, u32 *pixels)
+{
+	const u16 *pixel = src;
+	const u16 *end = src + *pixels;
+
+	while (pixel < end) {
+		const u32 avail = end - pixel;
+		const u32 run = dlfb_rle_run(pixel, min_t(u32, avail,
+							  RLE_MAX_COUNT));
+		u32 count;
+
+		/* a literal always stops where a run starts */
+		if (run >= 2) {
+			if (dst_end - dst < 1 + BPP)
+				break;
+			*dst++ = RLE_RUN | (run - 1);
+			memcpy(dst, pixel, BPP);
+			dst += BPP;
+			pixel += run;
+			continue;
+		}
+
+		count = dlfb_rle_literals(pixel, avail);
+		while (count) {
+			u32 chunk = min_t(u32, count, RLE_MAX_COUNT);
+
+			if (dst_end - dst < 1 + BPP)
+				goto out;
+			chunk = min_t(u32, chunk, (dst_end - dst - 1) / BPP);
+			*dst++ = chunk - 1;
+			memcpy(dst, pixel, chunk * BPP);
+			dst += chunk * BPP;
+			pixel += chunk;
+			count -= chunk;
+		}
+	}
+
+out:
+	*pixels = pixel - src;
+	return dst;
+}
+
+/*
+ * Pick the filter for a row of pixels: whichever leaves the most
+ * neighbours equal, which is what RLE makes runs of, with no filter
+ * winning ties. above is the row above as the sink has it, or NULL if
+ * that isn't known; a row the same as it is sent as a copy. The
+ * residuals, pixel less prediction modulo 2^16, are left in residual.
+ */
+int dlfb_row_filter(const u16 *pixel, const u16 *above, u32 pixels,
+		    u16 *residual)
+{
+	u32 plain = 0, sub = 0, vert = 0, i;
+
+	if (above && !memcmp(pixel, above, pixels * BPP))
+		return ROW_FILTER_COPY;
+
+	for (i = 1; i < pixels; i++) {
+		plain += pixel[i] == pixel[i - 1];
+		if (i > 1)
+			sub += (u16) (pixel[i] - pixel[i - 1]) ==
+				(u16) (pixel[i - 1] - pixel[i - 2]);
+		if (above)
+			vert += (u16) (pixel[i] - above[i]) ==
+				(u16) (pixel[i - 1] - above[i - 1]);
+	}
+
+	if ((vert > plain) && (vert >= sub)) {
+		for (i = 0; i < pixels; i++)
+			residual[i] = pixel[i] - above[i];
+		return ROW_FILTER_UP;
+	}
+
+	if (sub > plain) {
+		residual[0] = pixel[0];
+		for (i = 1; i < pixels; i++)
+			residual[i] = pixel[i] - pixel[i - 1];
+		return ROW_FILTER_SUB;
+	}
+
+	return ROW_FILTER_NONE;
+}
+
+/*
+ * Decode a filtered row into back as the sink will: from the residuals
+ * for sub and up, from above for a copy, and from pixel unfiltered.
+ */
+void dlfb_row_unfilter(int filter, const u16 *pixel, const u16 *residual,
+		       const u16 *above, u16 *back, u32 pixels)
+{
+	u32 i;
+
+	switch (filter) {
+	case ROW_FILTER_SUB:
+		for (i = 0; i < pixels; i++)
+			back[i] = (i ? back[i - 1] : 0) + residual[i];
+		break;
+	case ROW_FILTER_UP:
+		for (i = 0; i < pixels; i++)
+			back[i] = above[i] + residual[i];
+		break;
+	case ROW_FILTER_COPY:
+		memcpy(back, above, pixels * BPP);
+		break;
+	default:
+		memcpy(back, pixel, pixels * BPP);
+	}
+}
+
+/* Index bits per pixel of a palette of colours */
+int dlfb_palette_bits(int colours)
+{
+	if (colours <= 1)
+		return 0;
+	if (colours <= 2)
+		return 1;
+	if (colours <= 4)
+		return 2;
+	return 4;
+}
+
+/*
+ * Distinct colours of a rectangle, rows line_length bytes apart from
+ * rect, into palette in the order first seen. Returns how many, or 0 as
+ * soon as there are more than DL_PALETTE_MAX. Runs of a colour cost one
+ * compare a pixel.
+ */
+int dlfb_count_colours(const u8 *rect, u32 line_length,
+		       int width, int height, u16 *palette)
+{
+	int colours = 0;
+	u16 last = 0;
+	int row, col, i;
+
+	for (row = 0; row < height; row++) {
+		const u16 *pixel = (const u16 *) (rect + line_length * row);
+
+		for (col = 0; col < width; col++) {
+			if (colours && (pixel[col] == last))
+				continue;
+			last = pixel[col];
+			for (i = 0; (i < colours) && (palette[i] != last); i++)
+				;
+			if (i < colours)
+				continue;
+			if (colours == DL_PALETTE_MAX)
+				return 0;
+			palette[colours++] = last;
+		}
+	}
+
+	return colours;
+}
+
+/*
+ * Palette indices of a rectangle, packed from the high bits of each
+ * byte down with no padding between rows. A pixel not in the palette
+ * (drawn since it was counted) takes the first colour. back, if there
+ * is one, is the rectangle in the shadow, and gets the colours sent.
+ */
+char *dlfb_palette_encode(char *dst, const u8 *rect, u8 *back,
+			  u32 line_length, int width, int height,
+			  const u16 *palette, int colours)
+{
+	const int bits = dlfb_palette_bits(colours);
+	int row, col, i = 0;
+	int pending = 0;
+	u32 acc = 0;
+
+	for (row = 0; row < height; row++) {
+		const u16 *pixel = (const u16 *) (rect + line_length * row);
+		u16 *shadow = back ? (u16 *) (back + line_length * row) : NULL;
+
+		for (col = 0; col < width; col++) {
+			const u16 value = pixel[col];
+
+			/* neighbours mostly share a colour, try the last */
+			if (palette[i] != value) {
+				for (i = 0; (i < colours) &&
+				     (palette[i] != value); i++)
+					;
+				if (i == colours)
+					i = 0;
+			}
+			if (shadow)
+				shadow[col] = palette[i];
+
+			acc = (acc << bits) | i;
+			pending += bits;
+			if (pending >= 8) {
+				pending -= 8;
+				*dst++ = acc >> pending;
+			}
+		}
+	}
+	if (pending)
+		*dst++ = acc << (8 - pending);
+
+	return dst;
+}
+
+/* An n bit colour component widened to m bits, by repeating its bits */
+static u32 dlfb_widen(u32 value, int n, int m)
+{
+	u32 wide = 0;
+	int shift;
+
+	for (shift = m - n; shift > -n; shift -= n)
+		wide |= (shift >= 0) ? value << shift : value >> -shift;
+	return wide;
+}
+
+/*
+ * Reduce pixels starting at screen position x, y to depth, RGB444
+ * packed two pixels to three bytes or RGB332 a byte each, high bits
+ * first. A 4x4 ordered dither keyed to the screen position keeps flat
+ * areas from banding, and stays put from one frame to the next. back,
+ * if not NULL, gets the pixels as the sink widens them back.
+ */
+char *dlfb_lossy_encode(char *dst, const u16 *src, u16 *back,
+			int x, int y, u32 pixels, int depth)
+{
+	static const u8 bayer[4][4] = {
+		{  0,  8,  2, 10 },
+		{ 12,  4, 14,  6 },
+		{  3, 11,  1,  9 },
+		{ 15,  7, 13,  5 },
+	};
+	const u8 *order = bayer[y & 3];
+	/* bits dropped from red, green and blue */
+	const int rd = (depth == LOSSY_RGB444) ? 1 : 2;
+	const int gd = (depth == LOSSY_RGB444) ? 2 : 3;
+	const int bd = (depth == LOSSY_RGB444) ? 1 : 3;
+	u32 i, code, held = 0;
+
+	for (i = 0; i < pixels; i++) {
+		const int d = order[(x + i) & 3];
+		u32 r = src[i] >> 11;
+		u32 g = (src[i] >> 5) & 0x3f;
+		u32 b = src[i] & 0x1f;
+
+		r = min_t(u32, r + (d >> (4 - rd)), 0x1f) >> rd;
+		g = min_t(u32, g + (d >> (4 - gd)), 0x3f) >> gd;
+		b = min_t(u32, b + (d >> (4 - bd)), 0x1f) >> bd;
+
+		if (back)
+			back[i] = (dlfb_widen(r, 5 - rd, 5) << 11) |
+				(dlfb_widen(g, 6 - gd, 6) << 5) |
+				dlfb_widen(b, 5 - bd, 5);
+
+		if (depth == LOSSY_RGB332) {
+			*dst++ = (r << 5) | (g << 2) | b;
+			continue;
+		}
+
+		code = (r << 8) | (g << 4) | b;
+		if (i & 1) {
+			*dst++ = (held << 4) | (code >> 8);
+			*dst++ = code;
+		} else {
+			*dst++ = code >> 4;
+			held = code & 0xf;
+		}
+	}
+	if ((depth == LOSSY_RGB444) && (pixels & 1))
+		*dst++ = held << 4;
+
+	return dst;
+}
+
+/*
+ * Huffman code lengths for the byte counts in huff, by the two queue
+ * method: leaves sorted by count, and internal nodes, which come out
+ * in order of weight, each taking the two lightest of either. A code
+ * longer than HUFF_MAX_BITS only happens on very skewed counts; the
+ * leaf weights are flattened, halving each, until none is.
+ */
+static void dlfb_huffman_lengths(struct dlfb_huffman *huff)
+{
+	u32 *weight = huff->weight;
+	u16 *parent = huff->parent;
+	u8 *depth = huff->depth;
+	int n = 0, i, j, leaf, node, next, longest, shift;
+
+	/* symbols in use, insertion sorted by count */
+	for (i = 0; i < HUFF_SYMBOLS; i++) {
+		if (!huff->count[i])
+			continue;
+		for (j = n++; j && (huff->count[huff->sym[j - 1]] >
+				    huff->count[i]); j--)
+			huff->sym[j] = huff->sym[j - 1];
+		huff->sym[j] = i;
+	}
+
+	memset(huff->bits, 0, sizeof(huff->bits));
+	if (n <= 1) {
+		/* no input codes to nothing, a table of all zeros */
+		if (n)
+			huff->bits[huff->sym[0]] = 1;
+		return;
+	}
+
+	for (shift = 0; ; shift++) {
+		/* flattening keeps the order, so the leaves stay sorted */
+		for (i = 0; i < n; i++)
+			weight[i] = shift ? (huff->count[huff->sym[i]] >>
+					     shift) | 1 :
+				huff->count[huff->sym[i]];
+		leaf = 0;
+		node = n;
+		for (next = n; next < 2 * n - 1; next++) {
+			weight[next] = 0;
+			for (j = 0; j < 2; j++) {
+				i = ((leaf < n) && ((node == next) ||
+					(weight[leaf] <= weight[node]))) ?
+					leaf++ : node++;
+				parent[i] = next;
+				weight[next] += weight[i];
+			}
+		}
+
+		/* parents come after their children, the root last */
+		depth[2 * n - 2] = 0;
+		for (i = 2 * n - 3; i >= 0; i--)
+			depth[i] = depth[parent[i]] + 1;
+
+		longest = 0;
+		for (i = 0; i < n; i++)
+			longest = max_t(int, longest, depth[i]);
+		if (longest <= HUFF_MAX_BITS)
+			break;
+	}
+
+	for (i = 0; i < n; i++)
+		huff->bits[huff->sym[i]] = depth[i];
+}
+
+/*
+ * Canonical codes for the lengths: shorter codes first, and codes of
+ * one length in symbol order, so the lengths alone describe them.
+ */
+static void dlfb_huffman_codes(struct dlfb_huffman *huff)
+{
+	u16 lengths[HUFF_MAX_BITS + 1] = { 0 };
+	u16 next[HUFF_MAX_BITS + 1];
+	u16 code = 0;
+	int i;
+
+	for (i = 0; i < HUFF_SYMBOLS; i++)
+		lengths[huff->bits[i]]++;
+	lengths[0] = 0;
+	for (i = 1; i <= HUFF_MAX_BITS; i++) {
+		code = (code + lengths[i - 1]) << 1;
+		next[i] = code;
+	}
+	for (i = 0; i < HUFF_SYMBOLS; i++) {
+		if (huff->bits[i])
+			huff->code[i] = next[huff->bits[i]]++;
+	}
+}
+
+/*
+ * Huffman code src into dst with a table built from src itself: the
+ * code length of every byte value a nibble each, then the codes, high
+ * bits first, the last byte padded with zero bits. Returns the length,
+ * or 0 if it won't fit in dst_len.
+ */
+size_t dlfb_huffman_compress(struct dlfb_huffman *huff,
+			     const u8 *src, size_t src_len,
+			     u8 *dst, size_t dst_len)
+{
+	u8 *out = dst;
+	u64 total = 0;
+	u32 acc = 0;
+	int pending = 0;
+	size_t i;
+
+	if (dst_len <= HUFF_TABLE_BYTES)
+		return 0;
+
+	memset(huff->count, 0, sizeof(huff->count));
+	for (i = 0; i < src_len; i++)
+		huff->count[src[i]]++;
+	dlfb_huffman_lengths(huff);
+	for (i = 0; i < HUFF_SYMBOLS; i++)
+		total += (u64) huff->count[i] * huff->bits[i];
+	if (DIV_ROUND_UP_ULL(total, 8) > dst_len - HUFF_TABLE_BYTES)
+		return 0;
+	dlfb_huffman_codes(huff);
+
+	for (i = 0; i < HUFF_SYMBOLS; i += 2)
+		*out++ = (huff->bits[i] << 4) | huff->bits[i + 1];
+
+	for (i = 0; i < src_len; i++) {
+		acc = (acc << huff->bits[src[i]]) | huff->code[src[i]];
+		pending += huff->bits[src[i]];
+		while (pending >= 8) {
+			pending -= 8;
+			*out++ = acc >> pending;
+		}
+	}
+	if (pending)
+		*out++ = acc << (8 - pending);
+
+	return out - dst;
+}
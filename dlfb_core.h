@@ -0,0 +1,102 @@
+#ifndef DLFB_CORE_H
+#define DLFB_CORE_H
+
+/*
+ * Pixel work of the driver that needs no device: merging damage areas,
+ * diffing against the shadow buffer, and the segment encoders. None of
+ * it takes locks, allocates or sleeps, and all of it only touches the
+ * buffers it is given, so dlfb_core.c builds into the module as it is,
+ * and into userspace (make core) for refs/core_bench.c to test and time.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/string.h>
+#else
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+#endif
+
+#define BPP                     2
+
+/* words compared per step when diffing against the shadow buffer */
+#define TRIM_BLOCK_WORDS	4
+
+/* RLE format version 1, see documentation/compression.txt */
+#define RLE_RUN			0x80 /* opcode bit: run, else literals */
+#define RLE_MAX_COUNT		128 /* pixels per opcode, count-1 in 7 bits */
+#define RLE_MIN_RUN		3 /* shorter runs join a literal */
+#define RLE_SCAN_BYTES		16 /* compared per step finding runs */
+#define RLE_SCAN_PIXELS		(RLE_SCAN_BYTES / BPP)
+
+#define HUFF_SYMBOLS		256 /* bytes */
+#define HUFF_MAX_BITS		15 /* code length, fits the table's nibbles */
+#define HUFF_TABLE_BYTES	(HUFF_SYMBOLS / 2) /* a length per nibble */
+
+#define DL_PALETTE_MAX		16 /* colours in a palette tile, 4 bit indices */
+#define LOSSY_RGB444		1 /* depth byte of a lossy segment */
+#define LOSSY_RGB332		2
+
+struct dloarea {
+	int x, y;
+	int w, h;
+	int x2, y2;
+};
+
+/* Huffman table of a transfer, and scratch to build it in */
+struct dlfb_huffman {
+	u32 count[HUFF_SYMBOLS];
+	u8 bits[HUFF_SYMBOLS]; /* code length, 0 for unused */
+	u16 code[HUFF_SYMBOLS];
+	u8 sym[HUFF_SYMBOLS]; /* used symbols, by count */
+	u32 weight[2 * HUFF_SYMBOLS - 1]; /* leaves, then internal nodes */
+	u16 parent[2 * HUFF_SYMBOLS - 1];
+	u8 depth[2 * HUFF_SYMBOLS - 1];
+};
+
+/* row filters of filter segments, see dlfb_row_filter() */
+enum dlfb_row_filter {
+	ROW_FILTER_NONE,
+	ROW_FILTER_SUB, /* each pixel less the one to its left */
+	ROW_FILTER_UP, /* each pixel less the one above */
+	ROW_FILTER_COPY, /* the row above as it is, no data */
+};
+
+void dlfb_merge_area(struct dloarea *areas, int *count, int max_count,
+		     struct dloarea area);
+int dlfb_trim_hline(const u8 *bback, const u8 **bfront, int *width_bytes);
+void dlfb_xor_pixels(void *dst, const void *a, const void *b, u32 pixels);
+
+char *dlfb_put_varint(char *buf, u32 value);
+void dlfb_put_varint_fixed(char *buf, u32 value, int bytes);
+char *dlfb_rle_encode(char *dst, const char *dst_end,
+		      const u16 *src, u32 *pixels);
+
+int dlfb_row_filter(const u16 *pixel, const u16 *above, u32 pixels,
+		    u16 *residual);
+void dlfb_row_unfilter(int filter, const u16 *pixel, const u16 *residual,
+		       const u16 *above, u16 *back, u32 pixels);
+
+int dlfb_palette_bits(int colours);
+int dlfb_count_colours(const u8 *rect, u32 line_length,
+		       int width, int height, u16 *palette);
+char *dlfb_palette_encode(char *dst, const u8 *rect, u8 *back,
+			  u32 line_length, int width, int height,
+			  const u16 *palette, int colours);
+
+char *dlfb_lossy_encode(char *dst, const u16 *src, u16 *back,
+			int x, int y, u32 pixels, int depth);
+
+size_t dlfb_huffman_compress(struct dlfb_huffman *huff,
+			     const u8 *src, size_t src_len,
+			     u8 *dst, size_t dst_len);
+
+#endif
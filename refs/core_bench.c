@@ -0,0 +1,687 @@
+/*
+ * Test and benchmark driver for dlfb_core.c, the driver's damage merging,
+ * shadow diff and segment encoders, built for userspace. Runs under perf,
+ * valgrind and the sanitizers with no device or module.
+ *
+ * Build: make core (from the top directory), or with sanitizers
+ *        make core CORE_CFLAGS="-O1 -g -fsanitize=address,undefined"
+ *
+ *   core_bench t [rounds]      each core function against a plain C model
+ *                              on random and edge case input, decoding
+ *                              what the encoders make
+ *   core_bench b [frames]      each core function on 1024x768 desktop-like
+ *                              frames, as the driver calls it per flush
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dlfb_core.h"
+
+#define WIDTH		1024
+#define HEIGHT		768
+#define LINE		(WIDTH * BPP)
+#define TILE		32
+#define ROW_MAX		4096	/* pixels in a test row */
+#define AREAS		16	/* as DL_DAMAGE_AREAS */
+#define MIN_SECONDS	0.25	/* each benchmark runs at least this long */
+
+static int failures;
+
+#define CHECK(cond, what, round) do {					\
+	if (!(cond)) {							\
+		printf("%s: round %d: %s\n", what, round, #cond);	\
+		failures++;						\
+		return;							\
+	}								\
+} while (0)
+
+static u32 rnd(u32 n)
+{
+	return n ? (u32) rand() % n : 0;
+}
+
+/* random pixels in runs, of few or many colours */
+static void fill(u16 *pixel, u32 count)
+{
+	const u32 colours = rnd(3) ? 1 + rnd(8) : 65536;
+	u32 i = 0;
+
+	while (i < count) {
+		const u16 value = rnd(colours) * 7919;
+		u32 run = rnd(4) ? 1 : 1 + rnd(300);
+
+		while (run-- && (i < count))
+			pixel[i++] = value;
+	}
+}
+
+/* RLE version 1 opcodes, as the sink decodes them */
+static long rle_decode(u16 *dst, u32 pixels, const u8 *src, const u8 *end)
+{
+	const u8 *start = src;
+	u32 n = 0;
+
+	while (n < pixels) {
+		u32 count, i;
+		u8 op;
+
+		if (src == end)
+			return -1;
+		op = *src++;
+		count = (op & ~RLE_RUN) + 1;
+		if ((n + count > pixels) ||
+		    (end - src < (op & RLE_RUN ? 1 : count) * BPP))
+			return -1;
+		for (i = 0; i < count; i++) {
+			memcpy(&dst[n + i], src, BPP);
+			if (!(op & RLE_RUN))
+				src += BPP;
+		}
+		if (op & RLE_RUN)
+			src += BPP;
+		n += count;
+	}
+
+	return src - start;
+}
+
+static void test_rle(int round)
+{
+	static u16 src[ROW_MAX + 1], back[ROW_MAX];
+	static char dst[ROW_MAX * 3];
+	const u32 offset = rnd(4);
+	u32 want = rnd(ROW_MAX), pixels = want;
+	const u32 room = rnd(4) ? sizeof(dst) : rnd(want * BPP + 8);
+	char *end;
+
+	fill(src + offset, want);
+	end = dlfb_rle_encode(dst, dst + room, src + offset, &pixels);
+	CHECK(end <= dst + room, "rle", round);
+	CHECK((room < sizeof(dst)) || (pixels == want), "rle", round);
+	CHECK(rle_decode(back, pixels, (u8 *) dst, (u8 *) end) ==
+	      end - dst, "rle", round);
+	CHECK(!memcmp(back, src + offset, pixels * BPP), "rle", round);
+}
+
+static void test_trim(int round)
+{
+	static unsigned long shadow[ROW_MAX / 4], frame[ROW_MAX / 4];
+	const int words = rnd(ROW_MAX / 4);
+	const int bytes = words * sizeof(unsigned long);
+	const u8 *changed = (const u8 *) frame;
+	int width = bytes, identical, first = -1, last = -1, i;
+
+	for (i = 0; i < words; i++)
+		shadow[i] = frame[i] = rand();
+	for (i = rnd(4); i > 0; i--)
+		((u8 *) frame)[rnd(bytes)] ^= 1 + rnd(255);
+	for (i = 0; i < bytes; i++) {
+		if (((u8 *) frame)[i] != ((u8 *) shadow)[i]) {
+			first = first < 0 ? i : first;
+			last = i;
+		}
+	}
+
+	identical = dlfb_trim_hline((const u8 *) shadow, &changed, &width);
+	CHECK(identical + width == bytes, "trim", round);
+	if (first < 0) {
+		CHECK(!width, "trim", round);
+		return;
+	}
+	first -= first % sizeof(unsigned long);
+	last += sizeof(unsigned long) - last % sizeof(unsigned long);
+	CHECK(changed == (const u8 *) frame + first, "trim", round);
+	CHECK(width == last - first, "trim", round);
+}
+
+static void test_xor(int round)
+{
+	static u8 a[ROW_MAX * BPP + 8], b[ROW_MAX * BPP + 8];
+	static u8 dst[ROW_MAX * BPP + 8];
+	const u32 pixels = rnd(ROW_MAX);
+	const int shift = rnd(2) ? 0 : rnd(8);
+	u32 i;
+
+	for (i = 0; i < sizeof(a); i++) {
+		a[i] = rand();
+		b[i] = rand();
+	}
+	memset(dst, 0xAA, sizeof(dst));
+	dlfb_xor_pixels(dst + shift, a, b + shift, pixels);
+	for (i = 0; i < pixels * BPP; i++)
+		CHECK(dst[shift + i] == (a[i] ^ b[shift + i]), "xor", round);
+	CHECK((shift + i == sizeof(dst)) || (dst[shift + i] == 0xAA),
+	      "xor", round);
+}
+
+static void test_filter(int round)
+{
+	static u16 pixel[ROW_MAX], above[ROW_MAX], residual[ROW_MAX];
+	static u16 back[ROW_MAX];
+	const u32 pixels = 1 + rnd(ROW_MAX - 1);
+	const int kind = rnd(4);
+	const u16 *up = kind ? above : NULL;
+	u32 i;
+	int filter;
+
+	fill(above, pixels);
+	for (i = 0; i < pixels; i++) {
+		if (kind == 1)
+			pixel[i] = above[i];
+		else if (kind == 2)
+			pixel[i] = above[i] + 0x0841;
+		else
+			pixel[i] = i * 3 + round;
+	}
+	if ((kind != 1) && !rnd(4))
+		fill(pixel, pixels);
+
+	filter = dlfb_row_filter(pixel, up, pixels, residual);
+	CHECK((filter <= ROW_FILTER_SUB) || up, "filter", round);
+	CHECK((kind != 1) || (filter == ROW_FILTER_COPY), "filter", round);
+	dlfb_row_unfilter(filter, pixel, residual, up, back, pixels);
+	CHECK(!memcmp(back, pixel, pixels * BPP), "filter", round);
+}
+
+static void test_palette(int round)
+{
+	static u16 rect[TILE * 2 * TILE], back[TILE * 2 * TILE];
+	static char dst[TILE * TILE];
+	const int width = 1 + rnd(TILE), height = 1 + rnd(TILE);
+	const u32 line = TILE * 2 * BPP;
+	u16 palette[DL_PALETTE_MAX], seen[DL_PALETTE_MAX + 1];
+	int colours, bits, expect = 0, x, y, i, pending = 0;
+	const u8 *in = (const u8 *) dst;
+	u32 acc = 0;
+	char *end;
+
+	for (y = 0; y < height; y++)
+		fill(rect + y * TILE * 2, width);
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			const u16 p = rect[y * TILE * 2 + x];
+
+			for (i = 0; (i < expect) && (seen[i] != p); i++)
+				;
+			if ((i == expect) && (expect <= DL_PALETTE_MAX))
+				seen[expect++] = p;
+		}
+	}
+
+	colours = dlfb_count_colours((const u8 *) rect, line, width, height,
+				     palette);
+	CHECK(colours == (expect > DL_PALETTE_MAX ? 0 : expect),
+	      "palette", round);
+	if (!colours)
+		return;
+	CHECK(!memcmp(palette, seen, colours * BPP), "palette", round);
+
+	bits = dlfb_palette_bits(colours);
+	end = dlfb_palette_encode(dst, (const u8 *) rect, (u8 *) back, line,
+				  width, height, palette, colours);
+	CHECK(end - dst == (width * height * bits + 7) / 8, "palette", round);
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			if (pending < bits) {
+				acc = (acc << 8) | *in++;
+				pending += 8;
+			}
+			pending -= bits;
+			i = (acc >> pending) & ((1 << bits) - 1);
+			CHECK(palette[i] == rect[y * TILE * 2 + x],
+			      "palette", round);
+			CHECK(back[y * TILE * 2 + x] == palette[i],
+			      "palette", round);
+		}
+	}
+}
+
+/* n bits widened to m the way the sink does it */
+static u32 widen(u32 value, int n, int m)
+{
+	u32 wide = 0;
+	int i;
+
+	for (i = 0; i < m; i++)
+		wide |= ((value >> (n - 1 - i % n)) & 1) << (m - 1 - i);
+	return wide;
+}
+
+static void test_lossy(int round)
+{
+	static u16 src[ROW_MAX], back[ROW_MAX];
+	static u8 dst[ROW_MAX * 2];
+	const u32 pixels = 1 + rnd(ROW_MAX - 1);
+	const int depth = rnd(2) ? LOSSY_RGB444 : LOSSY_RGB332;
+	const int rb = depth == LOSSY_RGB444 ? 4 : 3;
+	const int gb = depth == LOSSY_RGB444 ? 4 : 3;
+	const int bb = depth == LOSSY_RGB444 ? 4 : 2;
+	u8 *end;
+	u32 i;
+
+	for (i = 0; i < pixels; i++)
+		src[i] = rand();
+	end = (u8 *) dlfb_lossy_encode((char *) dst, src, back, rnd(WIDTH),
+				       rnd(HEIGHT), pixels, depth);
+	CHECK(end - dst == (depth == LOSSY_RGB444 ?
+			    (pixels * 3 + 1) / 2 : pixels), "lossy", round);
+
+	for (i = 0; i < pixels; i++) {
+		u32 code, r, g, b, err;
+
+		if (depth == LOSSY_RGB332)
+			code = dst[i];
+		else if (i & 1)
+			code = ((dst[i / 2 * 3 + 1] & 0xf) << 8) |
+				dst[i / 2 * 3 + 2];
+		else
+			code = (dst[i / 2 * 3] << 4) | (dst[i / 2 * 3 + 1] >> 4);
+		r = code >> (gb + bb);
+		g = (code >> bb) & ((1 << gb) - 1);
+		b = code & ((1 << bb) - 1);
+		CHECK(back[i] == ((widen(r, rb, 5) << 11) |
+				  (widen(g, gb, 6) << 5) | widen(b, bb, 5)),
+		      "lossy", round);
+
+		/* dither moves a component by less than two of its steps */
+		err = abs((int) (src[i] >> 11) - (int) (back[i] >> 11));
+		CHECK(err < 2u << (5 - rb), "lossy", round);
+	}
+}
+
+/* canonical Huffman, as the sink decodes a COMPRESS_HUFFMAN transfer */
+static int huff_decode(u8 *dst, size_t len, const u8 *src, size_t src_len)
+{
+	u16 count[HUFF_MAX_BITS + 1] = { 0 }, first[HUFF_MAX_BITS + 1];
+	u16 index[HUFF_MAX_BITS + 1];
+	u8 bits[HUFF_SYMBOLS], order[HUFF_SYMBOLS];
+	size_t bit = HUFF_TABLE_BYTES * 8, n;
+	u16 code = 0, pos = 0;
+	int i, l;
+
+	for (i = 0; i < HUFF_SYMBOLS; i += 2) {
+		bits[i] = src[i / 2] >> 4;
+		bits[i + 1] = src[i / 2] & 0xf;
+	}
+	for (i = 0; i < HUFF_SYMBOLS; i++)
+		count[bits[i]]++;
+	count[0] = 0;
+	for (l = 1; l <= HUFF_MAX_BITS; l++) {
+		code = (code + count[l - 1]) << 1;
+		first[l] = code;
+		index[l] = pos;
+		for (i = 0; i < HUFF_SYMBOLS; i++)
+			if (bits[i] == l)
+				order[pos++] = i;
+	}
+
+	for (n = 0; n < len; n++) {
+		u32 c = 0;
+
+		for (l = 1; ; l++) {
+			if ((l > HUFF_MAX_BITS) || (bit >= src_len * 8))
+				return -1;
+			c = (c << 1) | ((src[bit / 8] >> (7 - bit % 8)) & 1);
+			bit++;
+			if ((c >= first[l]) && (c - first[l] < count[l]))
+				break;
+		}
+		dst[n] = order[index[l] + c - first[l]];
+	}
+
+	return (bit + 7) / 8 == src_len ? 0 : -1;
+}
+
+static void test_huffman(int round)
+{
+	static struct dlfb_huffman huff;
+	static u8 src[16384], dst[16384 + HUFF_TABLE_BYTES], back[16384];
+	/* empty input too, which codes to the table alone */
+	const size_t len = rnd(16) ? 1 + rnd(sizeof(src) - 1) : 0;
+	const size_t room = rnd(2) ? sizeof(dst) : rnd(len + HUFF_TABLE_BYTES);
+	const int skew = rnd(4);
+	u32 a = 1, b = 1, t;
+	size_t i, packed;
+
+	for (i = 0; i < len; i++) {
+		if (skew == 0) {
+			src[i] = rand();
+		} else if (skew == 1) {
+			src[i] = rnd(3) * 85;
+		} else {
+			/* Fibonacci counts make the longest codes */
+			src[i] = i < a ? i % 24 : rnd(24);
+			t = a + b;
+			a = b;
+			b = t;
+		}
+	}
+
+	packed = dlfb_huffman_compress(&huff, src, len, dst, room);
+	CHECK(packed <= room, "huffman", round);
+	if (!packed)
+		return;
+	CHECK(!huff_decode(back, len, dst, packed), "huffman", round);
+	CHECK(!memcmp(back, src, len), "huffman", round);
+}
+
+static int covers(const struct dloarea *a, const struct dloarea *b)
+{
+	return (a->x <= b->x) && (a->y <= b->y) &&
+		(a->x2 >= b->x2) && (a->y2 >= b->y2);
+}
+
+static struct dloarea random_area(void)
+{
+	struct dloarea a;
+
+	a.x = rnd(WIDTH);
+	a.y = rnd(HEIGHT);
+	a.w = 1 + rnd(rnd(2) ? 64 : WIDTH - a.x);
+	a.h = 1 + rnd(rnd(2) ? 64 : HEIGHT - a.y);
+	a.x2 = a.x + a.w;
+	a.y2 = a.y + a.h;
+	return a;
+}
+
+static void test_merge(int round)
+{
+	struct dloarea areas[AREAS], added[64];
+	const int n = 1 + rnd(64);
+	int count = 0, i, j;
+
+	for (i = 0; i < n; i++) {
+		added[i] = random_area();
+		dlfb_merge_area(areas, &count, AREAS, added[i]);
+		CHECK((count > 0) && (count <= AREAS), "merge", round);
+	}
+	for (i = 0; i < n; i++) {
+		for (j = 0; (j < count) && !covers(&areas[j], &added[i]); j++)
+			;
+		CHECK(j < count, "merge", round);
+	}
+	for (j = 0; j < count; j++)
+		CHECK((areas[j].w == areas[j].x2 - areas[j].x) &&
+		      (areas[j].h == areas[j].y2 - areas[j].y),
+		      "merge", round);
+}
+
+static int self_test(int rounds)
+{
+	int round;
+
+	srand(1);
+	for (round = 0; round < rounds; round++) {
+		test_rle(round);
+		test_trim(round);
+		test_xor(round);
+		test_filter(round);
+		test_palette(round);
+		test_lossy(round);
+		test_huffman(round);
+		test_merge(round);
+	}
+
+	printf("%d rounds, %d failures\n", rounds, failures);
+	return failures ? 1 : 0;
+}
+
+/*
+ * A frame in the shape of a desktop: flat background, a window of text
+ * that scrolls a little each frame, and photo-like noise in another.
+ */
+static void desktop_frame(u16 *pixels, int frame)
+{
+	int x, y;
+
+	for (y = 0; y < HEIGHT; y++) {
+		for (x = 0; x < WIDTH; x++) {
+			u16 *p = pixels + y * WIDTH + x;
+
+			if ((x > 100) && (x < 600) && (y > 80) && (y < 500))
+				*p = ((x * 7 + (y + frame) * 3) % 11) ?
+					0xFFFF : 0x0000;
+			else if ((x > 500) && (x < 900) && (y > 300) &&
+				 (y < 700))
+				*p = rand();
+			else
+				*p = 0x2104;
+		}
+	}
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct bench_state {
+	u16 *frames;
+	int count;
+	u16 *shadow;
+	u16 *scratch;
+	char *out;
+	struct dlfb_huffman huff;
+};
+
+/* trim every row of each frame against the one before, as a flush does */
+static size_t bench_trim(struct bench_state *s, const u16 *frame,
+			 const u16 *prev)
+{
+	size_t sent = 0;
+	int y;
+
+	for (y = 0; y < HEIGHT; y++) {
+		const u8 *changed = (const u8 *) (frame + y * WIDTH);
+		int width = LINE;
+
+		dlfb_trim_hline((const u8 *) (prev + y * WIDTH), &changed,
+				&width);
+		sent += width;
+	}
+	return sent;
+}
+
+static size_t bench_rle(struct bench_state *s, const u16 *frame,
+			const u16 *prev)
+{
+	char *out = s->out;
+	int y;
+
+	for (y = 0; y < HEIGHT; y++) {
+		u32 pixels = WIDTH;
+
+		out = dlfb_rle_encode(out, out + LINE * 2, frame + y * WIDTH,
+				      &pixels);
+	}
+	return out - s->out;
+}
+
+static size_t bench_delta(struct bench_state *s, const u16 *frame,
+			  const u16 *prev)
+{
+	char *out = s->out;
+	int y;
+
+	for (y = 0; y < HEIGHT; y++) {
+		u32 pixels = WIDTH;
+
+		dlfb_xor_pixels(s->scratch, frame + y * WIDTH,
+				prev + y * WIDTH, WIDTH);
+		out = dlfb_rle_encode(out, out + LINE * 2, s->scratch,
+				      &pixels);
+	}
+	return out - s->out;
+}
+
+static size_t bench_filter(struct bench_state *s, const u16 *frame,
+			   const u16 *prev)
+{
+	char *out = s->out;
+	int y;
+
+	for (y = 0; y < HEIGHT; y++) {
+		const u16 *row = frame + y * WIDTH;
+		const u16 *above = (y % TILE) ? s->shadow + (y - 1) * WIDTH :
+			NULL;
+		const int filter = dlfb_row_filter(row, above, WIDTH,
+						   s->scratch);
+		u32 pixels = WIDTH;
+
+		*out++ = filter;
+		if (filter != ROW_FILTER_COPY)
+			out = dlfb_rle_encode(out, out + LINE * 2,
+				filter == ROW_FILTER_NONE ? row : s->scratch,
+				&pixels);
+		dlfb_row_unfilter(filter, row, s->scratch, above,
+				  s->shadow + y * WIDTH, WIDTH);
+	}
+	return out - s->out;
+}
+
+static size_t bench_palette(struct bench_state *s, const u16 *frame,
+			    const u16 *prev)
+{
+	u16 palette[DL_PALETTE_MAX];
+	char *out = s->out;
+	int x, y, colours;
+
+	for (y = 0; y < HEIGHT; y += TILE) {
+		for (x = 0; x < WIDTH; x += TILE) {
+			const u8 *rect = (const u8 *) (frame + y * WIDTH + x);
+
+			colours = dlfb_count_colours(rect, LINE, TILE, TILE,
+						     palette);
+			if (colours)
+				out = dlfb_palette_encode(out, rect,
+					(u8 *) (s->shadow + y * WIDTH + x),
+					LINE, TILE, TILE, palette, colours);
+		}
+	}
+	return out - s->out;
+}
+
+static size_t bench_lossy(struct bench_state *s, const u16 *frame,
+			  const u16 *prev)
+{
+	char *out = s->out;
+	int y;
+
+	for (y = 0; y < HEIGHT; y++)
+		out = dlfb_lossy_encode(out, frame + y * WIDTH,
+					s->shadow + y * WIDTH, 0, y, WIDTH,
+					LOSSY_RGB444);
+	return out - s->out;
+}
+
+/* the frame's rle stream, Huffman coded a transfer at a time */
+static size_t bench_huffman(struct bench_state *s, const u16 *frame,
+			    const u16 *prev)
+{
+	const size_t chunk = 64 * 1024;
+	const size_t len = bench_rle(s, frame, prev);
+	u8 *stream = (u8 *) s->out;
+	u8 *packed = stream + len;
+	size_t at, sent = 0;
+
+	for (at = 0; at < len; at += chunk) {
+		const size_t n = len - at < chunk ? len - at : chunk;
+		const size_t out = dlfb_huffman_compress(&s->huff, stream + at,
+							 n, packed, n);
+
+		sent += out ? out : n;
+	}
+	return sent;
+}
+
+/* damage from the areas a frame's worth of drawing calls report */
+static size_t bench_merge(struct bench_state *s, const u16 *frame,
+			  const u16 *prev)
+{
+	struct dloarea areas[AREAS];
+	size_t pixels = 0;
+	int count = 0, i;
+
+	for (i = 0; i < 1000; i++)
+		dlfb_merge_area(areas, &count, AREAS, random_area());
+	for (i = 0; i < count; i++)
+		pixels += areas[i].w * areas[i].h;
+	return pixels * BPP;
+}
+
+static const struct {
+	const char *name;
+	size_t (*run)(struct bench_state *s, const u16 *frame,
+		      const u16 *prev);
+} benches[] = {
+	{ "trim", bench_trim },
+	{ "rle", bench_rle },
+	{ "delta", bench_delta },
+	{ "filter", bench_filter },
+	{ "palette", bench_palette },
+	{ "lossy444", bench_lossy },
+	{ "rle+huffman", bench_huffman },
+	{ "merge", bench_merge },
+};
+
+static int bench(int frames)
+{
+	const size_t pixels = (size_t) WIDTH * HEIGHT;
+	struct bench_state s;
+	int b, f;
+
+	s.count = frames;
+	s.frames = malloc(pixels * BPP * frames);
+	s.shadow = calloc(pixels, BPP);
+	s.scratch = malloc(LINE);
+	s.out = malloc(pixels * BPP * 4);
+	for (f = 0; f < frames; f++)
+		desktop_frame(s.frames + f * pixels, f);
+
+	printf("%d frames of %dx%d\n", frames, WIDTH, HEIGHT);
+	for (b = 0; b < (int) (sizeof(benches) / sizeof(benches[0])); b++) {
+		const double start = seconds();
+		double elapsed;
+		size_t bytes = 0;
+		long passes = 0;
+
+		do {
+			for (f = 1; f < frames; f++)
+				bytes = benches[b].run(&s,
+					s.frames + f * pixels,
+					s.frames + (f - 1) * pixels);
+			passes += frames - 1;
+			elapsed = seconds() - start;
+		} while (elapsed < MIN_SECONDS);
+
+		printf("  %-12s %8.1f MB/s %7.2f ns/pixel %6.1f%%\n",
+		       benches[b].name,
+		       pixels * BPP * passes / elapsed / 1e6,
+		       elapsed * 1e9 / (pixels * passes),
+		       bytes * 100.0 / (pixels * BPP));
+	}
+
+	free(s.frames);
+	free(s.shadow);
+	free(s.scratch);
+	free(s.out);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc >= 2) && !strcmp(argv[1], "t"))
+		return self_test(argc > 2 ? atoi(argv[2]) : 2000);
+	if ((argc >= 2) && !strcmp(argv[1], "b"))
+		return bench(argc > 2 ? atoi(argv[2]) < 2 ? 2 :
+			     atoi(argv[2]) : 10);
+
+	printf("usage: %s t [rounds]\n"
+	       "       %s b [frames]\n", argv[0], argv[0]);
+	return 2;
+}
@@ -1,125 +1,953 @@
+/*
+ * Reference decoder for the udlfb RLE format, version 1, and a corpus
+ * benchmark of the driver's encoders. See documentation/compression.txt.
+ * The encoders are the ones in dlfb_core.c, linked from libdlfbcore.a;
+ * the decoders here stand in for the sink.
+ *
+ * Build: make core (from the top directory); to include LZ4 in the
+ *        benchmark, make core CORE_CFLAGS="-O2 -DHAVE_LZ4" LDLIBS=-llz4
+ *
+ *   rle c <input> <output>   encode raw RGB565 pixels
+ *   rle d <input> <output>   decode back to raw pixels
+ *   rle t [rounds]           round-trip check on random and adversarial
+ *                            pixel data at every start alignment, and
+ *                            decoding of garbage
+ *   rle b [frames]           every encoder on a corpus of 1024x768
+ *                            desktop-like frames: speed, ratio and a
+ *                            round-trip check
+ *   rle b <W>x<H> <capture> ...
+ *                            the same on captures of raw RGB565 frames
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "dlfb_core.h"
+
+#define RLE_VERSION	1 /* as udlfb.h */
+
+/* worst case is a literal opcode for every RLE_MAX_COUNT pixels */
+static size_t rle_bound(size_t pixels)
+{
+	return 1 + pixels * BPP + (pixels + RLE_MAX_COUNT - 1) / RLE_MAX_COUNT;
+}
+
+/* opcodes only, for containers that carry the version elsewhere */
+static size_t rle_ops(u8 *dst, const u16 *src, size_t pixels)
+{
+	u32 count = pixels;
+
+	return (u8 *) dlfb_rle_encode((char *) dst,
+				      (char *) dst + rle_bound(pixels),
+				      src, &count) - dst;
+}
+
+/*
+ * Encode pixels into dst, which must hold rle_bound(pixels) bytes.
+ * The stream starts with the version byte. Returns its length.
+ */
+static size_t rle_encode(u8 *dst, const u16 *src, size_t pixels)
+{
+	*dst = RLE_VERSION;
+	return 1 + rle_ops(dst + 1, src, pixels);
+}
+
+/*
+ * Decode a stream of len bytes into at most max_pixels pixels.
+ * Returns the number of pixels, or -1 if the stream is malformed:
+ * unknown version, truncated opcode, or more pixels than fit.
+ */
+static long rle_decode(u16 *dst, size_t max_pixels, const u8 *src, size_t len)
+{
+	const u8 *end = src + len;
+	size_t pixels = 0;
+
+	if (!len || (*src++ != RLE_VERSION))
+		return -1;
+
+	while (src < end) {
+		const u8 op = *src++;
+		const u32 count = (op & ~RLE_RUN) + 1;
+		u16 value;
+		u32 i;
+
+		if (count > max_pixels - pixels)
+			return -1;
+
+		if (op & RLE_RUN) {
+			if (end - src < BPP)
+				return -1;
+			memcpy(&value, src, BPP);
+			src += BPP;
+			for (i = 0; i < count; i++)
+				dst[pixels++] = value;
+		} else {
+			if ((size_t) (end - src) < count * BPP)
+				return -1;
+			memcpy(dst + pixels, src, count * BPP);
+			src += count * BPP;
+			pixels += count;
+		}
+	}
+
+	return pixels;
+}
+
+/*
+ * Decode opcodes from src, up to end, into exactly pixels pixels.
+ * Returns the bytes used, or -1 if they run out or overshoot.
+ */
+static long rle_decode_ops(u16 *dst, size_t pixels, const u8 *src,
+			   const u8 *end)
+{
+	const u8 *start = src;
+	size_t n = 0;
+
+	while (n < pixels) {
+		u32 count, i;
+		u8 op;
+
+		if (src == end)
+			return -1;
+		op = *src++;
+		count = (op & ~RLE_RUN) + 1;
+		if (count > pixels - n)
+			return -1;
+
+		if (op & RLE_RUN) {
+			if (end - src < BPP)
+				return -1;
+			for (i = 0; i < count; i++)
+				memcpy(dst + n + i, src, BPP);
+			src += BPP;
+		} else {
+			if ((size_t) (end - src) < count * BPP)
+				return -1;
+			memcpy(dst + n, src, count * BPP);
+			src += count * BPP;
+		}
+		n += count;
+	}
+
+	return src - start;
+}
+
+static int read_file(const char *name, u8 **buf, size_t *len)
+{
+	FILE *f = fopen(name, "rb");
+	long size;
+
+	if (!f) {
+		printf("File reading failed\n");
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	*buf = malloc(size ? size : 1);
+	if (!*buf || (fread(*buf, 1, size, f) != (size_t) size)) {
+		fclose(f);
+		printf("File reading failed\n");
+		return -1;
+	}
+	fclose(f);
+	*len = size;
+	return 0;
+}
+
+static int write_file(const char *name, const void *buf, size_t len)
+{
+	FILE *f = fopen(name, "wb");
+
+	if (!f || (fwrite(buf, 1, len, f) != len)) {
+		printf("File writing failed\n");
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+/*
+ * pixels must have room for 3 more. The encoder compares a word of
+ * pixels at a time, so every start alignment must give the same bytes.
+ */
+static int round_trip(u16 *pixels, size_t count)
+{
+	u8 *stream = malloc(rle_bound(count));
+	u8 *shifted = malloc(rle_bound(count));
+	u16 *back = malloc((count ? count : 1) * BPP);
+	size_t len = rle_encode(stream, pixels, count);
+	long decoded = rle_decode(back, count, stream, len);
+	int ok = (len <= rle_bound(count)) && (decoded == (long) count) &&
+		!memcmp(pixels, back, count * BPP);
+	int shift;
+
+	for (shift = 1; shift < 4; shift++) {
+		memmove(pixels + shift, pixels + shift - 1, count * BPP);
+		ok = ok && (rle_encode(shifted, pixels + shift, count) == len) &&
+			!memcmp(stream, shifted, len);
+	}
+	memmove(pixels, pixels + 3, count * BPP);
+
+	free(stream);
+	free(shifted);
+	free(back);
+	return ok;
+}
+
+/* inputs aimed at the edges of the format */
+static size_t adversarial(u16 *pixels, size_t max, int kind)
+{
+	static const u16 values[] = { 0x0000, 0x0080, 0x7272, 0x8080,
+				      0xFFFF, 0x00FF };
+	static const u32 runs[] = { 1, 2, 3, 127, 128, 129, 255, 256, 257 };
+	size_t n = 0, i;
+
+	switch (kind) {
+	case 0: /* one long run */
+		while (n < max)
+			pixels[n++] = 0x7272;
+		break;
+	case 1: /* no two neighbours equal */
+		while (n < max) {
+			pixels[n] = values[n % 6];
+			n++;
+		}
+		break;
+	case 2: /* runs of every awkward length, back to back */
+		for (i = 0; n < max; i++) {
+			u32 r = runs[i % 9];
+
+			while (r-- && (n < max))
+				pixels[n++] = values[i % 6];
+		}
+		break;
+	case 3: /* pairs between literals */
+		while (n < max) {
+			pixels[n] = (n % 3 == 2) ? rand() : values[(n / 3) % 6];
+			n++;
+		}
+		break;
+	default: /* literal blocks of exactly 128 then a run */
+		while (n < max) {
+			for (i = 0; (i < RLE_MAX_COUNT) && (n < max); i++)
+				pixels[n++] = i;
+			for (i = 0; (i < 3) && (n < max); i++)
+				pixels[n++] = 0xFFFF;
+		}
+		break;
+	}
+
+	return n;
+}
+
+static int self_test(int rounds)
+{
+	const size_t max = 4096;
+	u16 *pixels = malloc((max + 3) * BPP);
+	u8 *garbage = malloc(max);
+	int failures = 0;
+	int round, kind;
+	size_t i, n;
+
+	for (kind = 0; kind < 5; kind++) {
+		for (n = 0; n <= 600; n++) {
+			adversarial(pixels, n, kind);
+			if (!round_trip(pixels, n)) {
+				printf("adversarial %d, %zu pixels: FAIL\n",
+				       kind, n);
+				failures++;
+			}
+		}
+	}
+
+	for (round = 0; round < rounds; round++) {
+		/* random data, with fewer values the more runs there are */
+		const u32 colours = 1 + rand() % (round % 4 ? 4 : 65536);
+		const u32 stretch = 1 + rand() % 64;
+
+		n = rand() % max;
+		for (i = 0; i < n; i++)
+			pixels[i] = (i % stretch) && i ? pixels[i - 1] :
+				rand() % colours;
+		if (!round_trip(pixels, n)) {
+			printf("random round %d, %zu pixels: FAIL\n", round, n);
+			failures++;
+		}
+
+		/* garbage must be rejected or decoded within bounds */
+		n = rand() % max;
+		for (i = 0; i < n; i++)
+			garbage[i] = rand();
+		if (n)
+			garbage[0] = RLE_VERSION;
+		rle_decode(pixels, rand() % max, garbage, n);
+	}
+
+	printf("%d failures\n", failures);
+	free(pixels);
+	free(garbage);
+	return failures ? 1 : 0;
+}
+
+/*
+ * A 1024x768 frame in the shape of a desktop: flat background, a few
+ * flat windows, and photo-like noise in one of them.
+ */
+static void desktop_frame(u16 *pixels, int width, int height, int frame)
+{
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			u16 *p = pixels + y * width + x;
+
+			if ((x > 100) && (x < 600) && (y > 80) && (y < 500))
+				*p = ((x + frame) & 31) ? 0xFFFF : 0x0000;
+			else if ((x > 500) && (x < 900) && (y > 300) &&
+				 (y < 700))
+				*p = rand();
+			else
+				*p = 0x2104;
+		}
+	}
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Corpus benchmark. A corpus is one or more captures, each a run of raw
+ * RGB565 frames of one size back to back, such as
+ *
+ *   dd if=/dev/fb1 of=terminal.raw bs=1572864 count=30
+ *
+ * for 30 frames of 1024x768. Every encoder below is run over every
+ * frame, each frame against the one before it as delta would see it
+ * (the first against black), and decoded again to check it round trips.
+ */
+
+#define TILE		32	/* the driver's default damage tile */
+#define CHUNK		65536	/* a transfer, for the whole-batch codecs */
+#define MIN_SECONDS	0.25	/* timing repeats a capture this long */
+
+struct capture {
+	const char *name;
+	int width, height;
+	int frames;
+	u16 *pixels;		/* frames back to back */
+};
+
+/*
+ * An encoder under test. dst holds frame_bound() bytes. decode gets the
+ * same prev, and returns 0 if it could make a frame of what it was given.
+ */
+struct encoder {
+	const char *name;
+	size_t (*encode)(u8 *dst, const u16 *frame, const u16 *prev,
+			 int width, int height);
+	int (*decode)(u16 *dst, const u8 *src, size_t len, const u16 *prev,
+		      int width, int height);
+};
+
+static u16 *scratch;		/* a frame of residuals */
+static u8 *stream;		/* frame_bound() of intermediate stream */
+
+static size_t frame_bound(int width, int height)
+{
+	return (size_t) width * height * BPP * 2 + 4 * CHUNK;
+}
+
+static void put32(u8 *p, u32 v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static u32 get32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32) p[3] << 24);
+}
+
+static size_t enc_rle(u8 *dst, const u16 *frame, const u16 *prev,
+		      int width, int height)
+{
+	return rle_encode(dst, frame, (size_t) width * height);
+}
+
+static int dec_rle(u16 *dst, const u8 *src, size_t len, const u16 *prev,
+		   int width, int height)
+{
+	const long pixels = (long) width * height;
+
+	return rle_decode(dst, pixels, src, len) == pixels ? 0 : -1;
+}
+
+/* XOR against the frame before, as delta batches send it */
+static size_t enc_delta(u8 *dst, const u16 *frame, const u16 *prev,
+			int width, int height)
+{
+	const size_t pixels = (size_t) width * height;
+
+	dlfb_xor_pixels(scratch, frame, prev, pixels);
+	return rle_encode(dst, scratch, pixels);
+}
+
+static int dec_delta(u16 *dst, const u8 *src, size_t len, const u16 *prev,
+		     int width, int height)
+{
+	const size_t pixels = (size_t) width * height;
+	size_t i;
+
+	if (dec_rle(dst, src, len, prev, width, height))
+		return -1;
+	for (i = 0; i < pixels; i++)
+		dst[i] ^= prev[i];
+	return 0;
+}
+
+/* a filter byte per row, then its opcodes unless it is a copy */
+static size_t enc_filter(u8 *dst, const u16 *frame, const u16 *prev,
+			 int width, int height)
+{
+	u8 *out = dst;
+	int y;
+
+	for (y = 0; y < height; y++) {
+		const u16 *row = frame + (size_t) y * width;
+		const int filter = dlfb_row_filter(row, y ? row - width : NULL,
+						   width, scratch);
+
+		*out++ = filter;
+		if (filter != ROW_FILTER_COPY)
+			out += rle_ops(out, filter == ROW_FILTER_NONE ?
+				       row : scratch, width);
+	}
 
-typedef unsigned u8;
-
-char *compress(char *str, long length) {
-	long count = 0;
-	
-	char *start1 = str;
-	char *start2 = str+1;
-	
-	char *c_first1 = str;
-	char *c_first2 = str+1;
-	
-	char *c_last1 = str;
-	char *c_last2 = str+1;
-	
-	char *c_write1 = str;
-	char *c_write2 = str+1;
-	
-	u8 run_len = 0;
-	
-	while (count != length) {
-		count = count + 2;
-		
-		c_last1 = c_last1 + 2;
-		c_last2 = c_last2 + 2;
-		++run_len;
-		
-		// end of run
-		if (run_len == 255 || *c_last1 != *c_first1 
-			|| *c_last2 != *c_first2) {
-			
-			// No repition. Input as output.
-			if(run_len < 2){
-				*c_write1 = *c_first1;
-				*c_write2 = *c_first2;
+	return out - dst;
+}
+
+static int dec_filter(u16 *dst, const u8 *src, size_t len, const u16 *prev,
+		      int width, int height)
+{
+	const u8 *end = src + len;
+	long used;
+	int y, i;
+
+	for (y = 0; y < height; y++) {
+		u16 *row = dst + (size_t) y * width;
+		const u16 *above = row - width;
+		int filter;
+
+		if (src == end)
+			return -1;
+		filter = *src++;
+		if (filter == ROW_FILTER_COPY) {
+			if (!y)
+				return -1;
+			memcpy(row, above, width * BPP);
+			continue;
+		}
+		used = rle_decode_ops(row, width, src, end);
+		if ((used < 0) || (filter > ROW_FILTER_UP) ||
+		    ((filter == ROW_FILTER_UP) && !y))
+			return -1;
+		src += used;
+		for (i = 0; i < width; i++) {
+			if ((filter == ROW_FILTER_SUB) && i)
+				row[i] += row[i - 1];
+			else if (filter == ROW_FILTER_UP)
+				row[i] += above[i];
+		}
+	}
+
+	return src == end ? 0 : -1;
+}
+
+/*
+ * Tile by tile, in rows of tiles: a colour count, then the palette and
+ * packed indices as palette segments carry them. 0 colours means the
+ * tile has too many, and its rows follow as opcodes.
+ */
+static size_t enc_palette(u8 *dst, const u16 *frame, const u16 *prev,
+			  int width, int height)
+{
+	const u32 line_length = width * BPP;
+	u16 palette[DL_PALETTE_MAX];
+	u8 *out = dst;
+	int tx, ty, y, colours;
+
+	for (ty = 0; ty < height; ty += TILE) {
+		for (tx = 0; tx < width; tx += TILE) {
+			const int w = width - tx < TILE ? width - tx : TILE;
+			const int h = height - ty < TILE ? height - ty : TILE;
+			const u16 *rect = frame + (size_t) ty * width + tx;
+
+			colours = dlfb_count_colours((const u8 *) rect,
+						     line_length, w, h,
+						     palette);
+			*out++ = colours;
+			if (!colours) {
+				for (y = 0; y < h; y++)
+					out += rle_ops(out, rect +
+						       (size_t) y * width, w);
+				continue;
 			}
-			
-			// repeated twice. Input as output.
-			if(run_len == 2){
-				// Write the input
-				*c_write1 = *c_first1;
-				*c_write2 = *c_first2;
-				
-				c_write1 = c_write1 + 2;
-				c_write2 = c_write2 + 2;
-				
-				// Write the input again. No encoding.
-				*c_write1 = *c_first1;
-				*c_write2 = *c_first2;				
+
+			memcpy(out, palette, colours * BPP);
+			out += colours * BPP;
+			out = (u8 *) dlfb_palette_encode((char *) out,
+				(const u8 *) rect, NULL, line_length, w, h,
+				palette, colours);
+		}
+	}
+
+	return out - dst;
+}
+
+static int dec_palette(u16 *dst, const u8 *src, size_t len, const u16 *prev,
+		       int width, int height)
+{
+	const u8 *end = src + len;
+	u16 palette[DL_PALETTE_MAX];
+	int tx, ty, x, y;
+	long used;
+
+	for (ty = 0; ty < height; ty += TILE) {
+		for (tx = 0; tx < width; tx += TILE) {
+			const int w = width - tx < TILE ? width - tx : TILE;
+			const int h = height - ty < TILE ? height - ty : TILE;
+			int colours, bits, pending = 0, index;
+			u32 acc = 0;
+
+			if (src == end)
+				return -1;
+			colours = *src++;
+			if (!colours) {
+				for (y = ty; y < ty + h; y++) {
+					used = rle_decode_ops(dst +
+						(size_t) y * width + tx, w,
+						src, end);
+					if (used < 0)
+						return -1;
+					src += used;
+				}
+				continue;
 			}
-			
-			// run_len >= 3. We also add a special char.
-			else if(run_len > 2){
-				// Skip 2 bytes. We shall write the special char
-				// here at the end.
-				c_write1 = c_write1 + 2;
-				c_write2 = c_write2 + 2;
-				
-				// Write run_len
-				*c_write1 = run_len;
-				
-				c_write1 = c_write1 + 1;
-				c_write2 = c_write2 + 1;
-				
-				// Write the repeated bytes
-				*c_write1 = *c_first1;
-				*c_write2 = *c_first2;
-				
-				// Now go back and write the special char
-				*(c_write1-3) = 'r';
-				*(c_write2-3) = 'r';			
-				
+
+			bits = dlfb_palette_bits(colours);
+			if ((colours > DL_PALETTE_MAX) ||
+			    ((size_t) (end - src) < colours * BPP +
+			     ((size_t) w * h * bits + 7) / 8))
+				return -1;
+			memcpy(palette, src, colours * BPP);
+			src += colours * BPP;
+			for (y = ty; y < ty + h; y++) {
+				for (x = tx; x < tx + w; x++) {
+					if (pending < bits) {
+						acc = (acc << 8) | *src++;
+						pending += 8;
+					}
+					pending -= bits;
+					index = (acc >> pending) &
+						((1 << bits) - 1);
+					if (index >= colours)
+						return -1;
+					dst[(size_t) y * width + x] =
+						palette[index];
+				}
 			}
-			
-			// set write pointers for next write
-			c_write1 = c_write1 + 2;
-			c_write2 = c_write2 + 2;
-				
-			// start next run
-			run_len = 0; 
-			c_first1 = c_last1;
-			c_first2 = c_last2;
-		}
-		
-		str = str + 2;
-	}
-	*c_write1 = 'e';
-	return start1;
-}
-
-
-int main(int argc, char **argv) {
-	char * buffer = 0;
-	long length;
-	FILE * f_in = fopen ("input", "rb");
-	FILE * f_out = fopen("output", "wb");
-
-	if (f_in)
-	{
-		fseek (f_in, 0, SEEK_END);
-		length = ftell (f_in);
-		fseek (f_in, 0, SEEK_SET);
-		buffer = malloc (length);
-		if (buffer){
-			fread (buffer, 1, length, f_in);
-		}
-		fclose (f_in);
-	} else{
-		printf("File reading failed\n");
+		}
+	}
+
+	return src == end ? 0 : -1;
+}
+
+/* first code of each length, and where its symbols start in order */
+static void huff_canonical(const u8 *bits, u16 *first, u16 *index, u8 *order)
+{
+	u16 count[HUFF_MAX_BITS + 1] = { 0 };
+	u16 code = 0, pos = 0;
+	int len, i;
+
+	for (i = 0; i < HUFF_SYMBOLS; i++)
+		count[bits[i]]++;
+	count[0] = 0;
+	for (len = 1; len <= HUFF_MAX_BITS; len++) {
+		code = (code + count[len - 1]) << 1;
+		first[len] = code;
+		index[len] = pos;
+		for (i = 0; i < HUFF_SYMBOLS; i++)
+			if (bits[i] == len)
+				order[pos++] = i;
 	}
+}
+
+static int huff_decode(u8 *dst, size_t len, const u8 *src, size_t src_len)
+{
+	u16 first[HUFF_MAX_BITS + 1], index[HUFF_MAX_BITS + 1];
+	u16 count[HUFF_MAX_BITS + 1] = { 0 };
+	u8 bits[HUFF_SYMBOLS], order[HUFF_SYMBOLS];
+	size_t bit = HUFF_TABLE_BYTES * 8, n;
+	int i, l;
+
+	if (src_len < HUFF_TABLE_BYTES)
+		return -1;
+	for (i = 0; i < HUFF_SYMBOLS; i += 2) {
+		bits[i] = src[i / 2] >> 4;
+		bits[i + 1] = src[i / 2] & 0xf;
+	}
+	for (i = 0; i < HUFF_SYMBOLS; i++)
+		count[bits[i]]++;
+	huff_canonical(bits, first, index, order);
+
+	for (n = 0; n < len; n++) {
+		u32 c = 0;
 
-	if (buffer && f_out){
-		buffer = compress(buffer, length);
-		
-		while(*buffer != 'e'){
-			fwrite(buffer, 1, 1, f_out);
-			buffer = buffer + 1;
+		for (l = 1; ; l++) {
+			if ((l > HUFF_MAX_BITS) || (bit >= src_len * 8))
+				return -1;
+			c = (c << 1) | ((src[bit / 8] >> (7 - bit % 8)) & 1);
+			bit++;
+			if ((c >= first[l]) && (c - first[l] < count[l]))
+				break;
 		}
-		fclose(f_out);
+		dst[n] = order[index[l] + c - first[l]];
 	}
-	
+
 	return 0;
 }
+
+/*
+ * The RLE stream of the frame in transfer sized chunks, each Huffman
+ * coded with its own table, or stored when that doesn't pay: a kind
+ * byte (0 stored, 2 Huffman), the chunk's length, its coded length.
+ */
+static size_t enc_huffman(u8 *dst, const u16 *frame, const u16 *prev,
+			  int width, int height)
+{
+	static struct dlfb_huffman huff;
+	const size_t len = rle_encode(stream, frame, (size_t) width * height);
+	u8 *out = dst;
+	size_t at, chunk, coded;
+
+	for (at = 0; at < len; at += chunk) {
+		chunk = len - at < CHUNK ? len - at : CHUNK;
+		/* only worth it smaller than the chunk, as the driver does */
+		coded = dlfb_huffman_compress(&huff, stream + at, chunk,
+					      out + 9, chunk - 1);
+		*out = coded ? 2 : 0;
+		if (!coded) {
+			memcpy(out + 9, stream + at, chunk);
+			coded = chunk;
+		}
+		put32(out + 1, chunk);
+		put32(out + 5, coded);
+		out += 9 + coded;
+	}
+
+	return out - dst;
+}
+
+static int dec_huffman(u16 *dst, const u8 *src, size_t len, const u16 *prev,
+		       int width, int height)
+{
+	const u8 *end = src + len;
+	size_t at = 0;
+
+	while (src < end) {
+		u32 chunk, coded;
+
+		if (end - src < 9)
+			return -1;
+		chunk = get32(src + 1);
+		coded = get32(src + 5);
+		if (((size_t) (end - src) - 9 < coded) ||
+		    (at + chunk > frame_bound(width, height)))
+			return -1;
+		if (*src == 2) {
+			if (huff_decode(stream + at, chunk, src + 9, coded))
+				return -1;
+		} else if (!*src && (coded == chunk)) {
+			memcpy(stream + at, src + 9, chunk);
+		} else {
+			return -1;
+		}
+		at += chunk;
+		src += 9 + coded;
+	}
+
+	return dec_rle(dst, stream, at, prev, width, height);
+}
+
+#ifdef HAVE_LZ4
+/* raw frame bytes in transfer sized LZ4 blocks, as lz4 batches go */
+static size_t enc_lz4(u8 *dst, const u16 *frame, const u16 *prev,
+		      int width, int height)
+{
+	const size_t len = (size_t) width * height * BPP;
+	const char *src = (const char *) frame;
+	u8 *out = dst;
+	size_t at, chunk;
+	int coded;
+
+	for (at = 0; at < len; at += chunk) {
+		chunk = len - at < CHUNK ? len - at : CHUNK;
+		coded = LZ4_compress_default(src + at, (char *) out + 8, chunk,
+					     LZ4_compressBound(chunk));
+		put32(out, chunk);
+		put32(out + 4, coded);
+		out += 8 + coded;
+	}
+
+	return out - dst;
+}
+
+static int dec_lz4(u16 *dst, const u8 *src, size_t len, const u16 *prev,
+		   int width, int height)
+{
+	const size_t size = (size_t) width * height * BPP;
+	const u8 *end = src + len;
+	char *out = (char *) dst;
+	size_t at = 0;
+
+	while (src < end) {
+		u32 chunk, coded;
+
+		if (end - src < 8)
+			return -1;
+		chunk = get32(src);
+		coded = get32(src + 4);
+		if (((size_t) (end - src) - 8 < coded) || (at + chunk > size) ||
+		    (LZ4_decompress_safe((const char *) src + 8, out + at,
+					 coded, chunk) != (int) chunk))
+			return -1;
+		at += chunk;
+		src += 8 + coded;
+	}
+
+	return at == size ? 0 : -1;
+}
+#endif
+
+static const struct encoder encoders[] = {
+	{ "rle", enc_rle, dec_rle },
+	{ "delta", enc_delta, dec_delta },
+	{ "filter", enc_filter, dec_filter },
+	{ "palette", enc_palette, dec_palette },
+	{ "rle+huffman", enc_huffman, dec_huffman },
+#ifdef HAVE_LZ4
+	{ "lz4", enc_lz4, dec_lz4 },
+#endif
+};
+
+/* encodes one capture in one pass, returns the bytes it came to */
+static size_t encode_capture(const struct encoder *enc,
+			     const struct capture *cap, const u16 *black,
+			     u8 *out)
+{
+	const size_t pixels = (size_t) cap->width * cap->height;
+	size_t bytes = 0;
+	int f;
+
+	for (f = 0; f < cap->frames; f++)
+		bytes += enc->encode(out, cap->pixels + f * pixels,
+				     f ? cap->pixels + (f - 1) * pixels : black,
+				     cap->width, cap->height);
+	return bytes;
+}
+
+/* every frame through encode and decode, compared with what went in */
+static int verify_capture(const struct encoder *enc,
+			  const struct capture *cap, const u16 *black,
+			  u8 *out, u16 *back)
+{
+	const size_t pixels = (size_t) cap->width * cap->height;
+	int f;
+
+	for (f = 0; f < cap->frames; f++) {
+		const u16 *frame = cap->pixels + f * pixels;
+		const u16 *prev = f ? frame - pixels : black;
+		const size_t len = enc->encode(out, frame, prev, cap->width,
+					       cap->height);
+
+		if ((len > frame_bound(cap->width, cap->height)) ||
+		    enc->decode(back, out, len, prev, cap->width,
+				cap->height) ||
+		    memcmp(back, frame, pixels * BPP))
+			return -1;
+	}
+	return 0;
+}
+
+static int corpus(const struct capture *caps, int count)
+{
+	int failures = 0;
+	int c, e;
+
+	for (c = 0; c < count; c++) {
+		const struct capture *cap = &caps[c];
+		const size_t pixels = (size_t) cap->width * cap->height;
+		const double raw = (double) pixels * BPP * cap->frames;
+		u8 *out = malloc(frame_bound(cap->width, cap->height));
+		u16 *back = malloc(pixels * BPP);
+		u16 *black = calloc(pixels, BPP);
+
+		scratch = malloc(pixels * BPP);
+		stream = malloc(frame_bound(cap->width, cap->height));
+
+		printf("%s: %d frames of %dx%d\n", cap->name, cap->frames,
+		       cap->width, cap->height);
+		for (e = 0; e < (int) (sizeof(encoders) / sizeof(encoders[0]));
+		     e++) {
+			const struct encoder *enc = &encoders[e];
+			const int ok = !verify_capture(enc, cap, black, out,
+						       back);
+			double start = seconds(), elapsed;
+			size_t bytes = 0;
+			int passes = 0;
+
+			do {
+				bytes = encode_capture(enc, cap, black, out);
+				passes++;
+				elapsed = seconds() - start;
+			} while (elapsed < MIN_SECONDS);
+
+			printf("  %-12s %8.1f MB/s %7.2f ns/pixel %6.1f%%  %s\n",
+			       enc->name, raw * passes / elapsed / 1e6,
+			       elapsed * 1e9 / (pixels * cap->frames * passes),
+			       bytes * 100.0 / raw, ok ? "ok" : "ROUND TRIP FAIL");
+			failures += !ok;
+		}
+
+		free(out);
+		free(back);
+		free(black);
+		free(scratch);
+		free(stream);
+	}
+
+	return failures ? 1 : 0;
+}
+
+/* a capture file of width x height frames, by its name */
+static int load_capture(struct capture *cap, const char *name,
+			int width, int height)
+{
+	const size_t frame = (size_t) width * height * BPP;
+	size_t len;
+	u8 *buf;
+
+	if (read_file(name, &buf, &len))
+		return -1;
+	if (!len || (len % frame)) {
+		printf("%s: not whole %dx%d frames\n", name, width, height);
+		free(buf);
+		return -1;
+	}
+
+	cap->name = name;
+	cap->width = width;
+	cap->height = height;
+	cap->frames = len / frame;
+	cap->pixels = (u16 *) buf;
+	return 0;
+}
+
+/* the corpus of frames desktop_frame() makes, for when there is no capture */
+static int bench(int frames)
+{
+	struct capture cap = { "synthetic", 1024, 768, frames, NULL };
+	const size_t pixels = (size_t) cap.width * cap.height;
+	int f, ret;
+
+	cap.pixels = malloc(pixels * BPP * frames);
+	for (f = 0; f < frames; f++)
+		desktop_frame(cap.pixels + f * pixels, cap.width, cap.height,
+			      f);
+	ret = corpus(&cap, 1);
+	free(cap.pixels);
+	return ret;
+}
+
+/* captures given as WxH and their files */
+static int bench_files(int argc, char **argv)
+{
+	struct capture *caps = calloc(argc, sizeof(*caps));
+	int width, height, count = 0, ret = 1;
+
+	if (sscanf(argv[0], "%dx%d", &width, &height) != 2 ||
+	    (width <= 0) || (height <= 0)) {
+		printf("%s: not a frame size\n", argv[0]);
+		goto out;
+	}
+
+	for (count = 0; count < argc - 1; count++)
+		if (load_capture(&caps[count], argv[count + 1], width, height))
+			goto out;
+	ret = corpus(caps, count);
+out:
+	while (--count >= 0)
+		free(caps[count].pixels);
+	free(caps);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	u8 *in, *out;
+	size_t len;
+	long pixels;
+	int ret;
+
+	if ((argc >= 2) && !strcmp(argv[1], "t"))
+		return self_test(argc > 2 ? atoi(argv[2]) : 10000);
+	if ((argc >= 3) && !strcmp(argv[1], "b") && strchr(argv[2], 'x'))
+		return bench_files(argc - 2, argv + 2);
+	if ((argc >= 2) && !strcmp(argv[1], "b"))
+		return bench(argc > 2 ? atoi(argv[2]) : 20);
+
+	if ((argc != 4) || (strcmp(argv[1], "c") && strcmp(argv[1], "d"))) {
+		printf("usage: %s c|d <input> <output>\n"
+		       "       %s t [rounds]\n"
+		       "       %s b [frames]\n"
+		       "       %s b <W>x<H> <capture> ...\n",
+		       argv[0], argv[0], argv[0], argv[0]);
+		return 2;
+	}
+
+	if (read_file(argv[2], &in, &len))
+		return 1;
+
+	if (!strcmp(argv[1], "c")) {
+		out = malloc(rle_bound(len / BPP));
+		len = rle_encode(out, (const u16 *) in, len / BPP);
+	} else {
+		/* every opcode byte yields at most RLE_MAX_COUNT pixels */
+		out = malloc(len * RLE_MAX_COUNT * BPP + 1);
+		pixels = rle_decode((u16 *) out, len * RLE_MAX_COUNT, in, len);
+		if (pixels < 0) {
+			printf("Malformed stream\n");
+			free(in);
+			free(out);
+			return 1;
+		}
+		len = pixels * BPP;
+	}
+
+	ret = write_file(argv[3], out, len) ? 1 : 0;
+	free(in);
+	free(out);
+	return ret;
+}
@@ -16,17 +16,51 @@
 #define VM_RESERVED (VM_DONTEXPAND | VM_DONTDUMP)
 #endif
 
-struct dloarea {
-	int x, y;
-	int w, h;
-	int x2, y2;
+#include "dlfb_core.h"
+
+#define DL_DAMAGE_AREAS 16 /* coalesced rects queued per frame */
+#define DL_ENCODE_THREADS_MAX 8 /* bands a flush is encoded in, at most */
+
+/* per tile codecs the auto codec picks from, also their wire values */
+#define DL_TILE_CODECS 6 /* none, rle, delta, palette, lossy, filter */
+#define DL_ROW_FILTERS 4 /* none, sub, up, copy */
+
+/* what the auto codec has seen of one damage tile */
+struct dlfb_tile_stat {
+	unsigned long stamp; /* jiffies at the last update */
+	u16 interval; /* recent ms between updates */
+	u16 ratio[DL_TILE_CODECS]; /* recent encoded / raw bytes, DL_RATIO_ONE */
+	u32 in, out, cycles; /* this flush, for the first tile of a span */
+	u8 now; /* codec this flush, after a palette tile falls back */
+	u8 colours; /* palette tiles this flush: palette size, */
+	u8 top, left, rows, cols; /* and the changed part, in the tile */
+	u8 depth; /* what the sink has, LOSSY_* or 0 for exact */
+	u8 codec; /* current choice */
+	u8 trying; /* codec for one flush to compare, or DL_TILE_CODECS */
+	u8 uses; /* flushes on the choice since the last try */
+	u8 tries; /* picks what to try next */
 };
 
+#define DL_URB_AREAS 8 /* regions remembered per urb for resend */
+#define DL_SG_ENTRIES 64 /* header plus framebuffer pages per sg urb */
+#define DL_SG_HEADER_MAX 16
+/* leaves an entry for a start that isn't page aligned */
+#define DL_SG_MAX_BYTES ((DL_SG_ENTRIES - 2) * PAGE_SIZE)
+
 struct urb_node {
 	struct list_head entry;
 	struct dlfb_data *dev;
 	struct delayed_work release_urb_work;
 	struct urb *urb;
+	u32 seg_end; /* byte offset where the last batched segment ended */
+	int codec; /* enum dlfb_codec of the batch being filled */
+	u8 packed; /* COMPRESS_* it is staged for when it ends, or 0 */
+	ktime_t submit_time;
+	struct dloarea areas[DL_URB_AREAS]; /* what it carries, for resend */
+	int area_count;
+	/* zero-copy transfers: command header, then framebuffer pages */
+	struct scatterlist sg[DL_SG_ENTRIES];
+	u8 sg_header[DL_SG_HEADER_MAX];
 };
 
 struct urb_list {
@@ -36,6 +70,40 @@ struct urb_list {
 	int available;
 	int count;
 	size_t size;
+	bool streaming; /* buffers are kmalloc + streaming DMA, not coherent */
+	struct device *dma_dev; /* the hcd, which streaming buffers map to */
+	/* link statistics for autotune, under lock */
+	ktime_t last_complete;
+	u64 stat_bytes;
+	u64 stat_busy_us;
+	u32 stat_transfers;
+	u32 stat_min_rtt_us;
+	atomic_t waits; /* times the renderer found no urb free */
+	int autotune;
+	unsigned long autotune_stamp;
+};
+
+/*
+ * A flush with a lot of damage is encoded in bands of whole tile rows,
+ * one per encode thread, into segments that are then put into batches
+ * in order. See dlfb_render_bands().
+ */
+struct dlfb_band_seg {
+	u32 byte_offset; /* where the segment starts in the framebuffer */
+	u16 len; /* framebuffer bytes it covers */
+	u16 bytes; /* of data, everything after the skip */
+	u8 codec; /* enum dlfb_codec of the batch it goes in */
+	char data[];
+};
+
+struct dlfb_band {
+	struct work_struct work;
+	struct dlfb_data *dev;
+	int ty, ty_end; /* tile rows to encode */
+	int ty_done; /* tile rows before this were encoded whole */
+	char *buf; /* DL_BAND_BYTES of segments, then DL_DELTA_PIXELS scratch */
+	u32 used;
+	int ident; /* bytes trimmed away */
 };
 
 struct beaglevideo{
@@ -49,6 +117,7 @@ struct beaglevideo{
 	bool virtualized; /* true when physical usb device not present */
 	atomic_t usb_active; /* 0 = update virtual buffer, but no usb traffic */
 	atomic_t lost_pixels; /* 1 = a render op failed. Need screen refresh */
+	atomic_t congested; /* 1 = a flush found no free urb, damage pending */
 	char *edid; /* null until we read edid from hw or get from sysfs */
 	size_t edid_size;
 	int sku_pixel_limit;
@@ -59,6 +128,49 @@ struct beaglevideo{
 	atomic_t bytes_identical; /* saved effort with backbuffer comparison */
 	atomic_t bytes_sent; /* to usb, after compression including overhead */
 	atomic_t cpu_kcycles_used; /* transpired during pixel processing */
+
+	/* damage tracking, see dlfb_mark_damage() */
+	spinlock_t damage_lock; /* guards damage_areas and dirty_tiles */
+	struct dloarea damage_areas[DL_DAMAGE_AREAS]; /* queued for next tick */
+	int damage_count;
+	struct delayed_work damage_work; /* flushes once per frame interval */
+	struct mutex render_lock; /* one flush at a time */
+	unsigned long *dirty_tiles; /* one bit per tile, row-major */
+	unsigned long *flush_tiles; /* snapshot being flushed */
+	unsigned long *resend_tiles; /* lost on the wire, send untrimmed */
+	unsigned long *flush_resend; /* snapshot of resend_tiles */
+	int tile_shift; /* tiles are (1 << tile_shift) pixels square */
+	int tiles_x;
+	int tiles_y;
+	bool sg_capable; /* hcd takes sg lists of any element length */
+	int codec; /* enum dlfb_codec, changed under render_lock */
+	u16 *delta_buf; /* DL_DELTA_PIXELS of XOR delta, once delta is used */
+	char *lz4_buf; /* batch staged for compression, DL_TRANSFER_MAX */
+	void *lz4_wrkmem; /* LZ4_MEM_COMPRESS of hash table */
+	char *lz4_out; /* worst case output, for lib/lz4 before 4.11 */
+	u16 lz4_ratio; /* recent compressed / staged bytes, DL_RATIO_ONE */
+	u8 lz4_skipped; /* auto batches not compressed since the last */
+	bool entropy; /* RLE, delta and mixed batches Huffman coded */
+	char *huff_buf; /* batch staged for Huffman coding, DL_TRANSFER_MAX */
+	struct dlfb_huffman *huff; /* its table and scratch */
+	u16 huff_ratio; /* recent coded / staged bytes, DL_RATIO_ONE */
+	struct dlfb_tile_stat *tile_stats; /* one per tile, for auto */
+	u16 *row_palettes; /* DL_PALETTE_MAX per tile of a tile row */
+	unsigned long *lossy_tiles; /* on the sink at reduced depth */
+	u32 bandwidth_target; /* KiB/s, hot tiles go lossy above; 0 = off */
+	u8 lossy_depth; /* LOSSY_RGB444 or LOSSY_RGB332 while over, else 0 */
+	bool progressive; /* big damage goes coarse first, then refined */
+	bool coarse; /* this flush is big damage, sent at RGB332 */
+	bool refining; /* this flush is lossy tiles a step up, link idle */
+	u8 flush_depth; /* what lossy tiles go at this flush */
+	unsigned long rate_stamp; /* start of the window rate_bytes covers */
+	u32 rate_bytes; /* sent in the current window */
+	u32 auto_cycles[DL_TILE_CODECS]; /* recent encode cycles per KiB */
+	atomic_t codec_in[DL_TILE_CODECS]; /* bytes encoded by auto */
+	atomic_t codec_out[DL_TILE_CODECS]; /* what they came to */
+	atomic_t filter_rows[DL_ROW_FILTERS]; /* filter segments by filter */
+	int encode_threads; /* bands a big flush is encoded in, 1 = serial */
+	struct dlfb_band bands[DL_ENCODE_THREADS_MAX];
 	unsigned char *	bulk_in_buffer;	/* the buffer to in data */
 };
 
@@ -73,6 +185,7 @@ struct dlfb_data {
 	__u8 bulk_in_endpointAddr;	/* bulk in endpoint address */
 	__u8 bulk_out_endpointAddr; /* bulk in endpoint address */
 	size_t	bulk_in_size;	/* the size of the in buffer */
+	size_t	bulk_out_size;	/* wMaxPacketSize of bulk out */
 
 
 	struct beaglevideo video;
@@ -83,17 +196,76 @@ struct dlfb_data {
 
 /* -BULK_SIZE as per usb-skeleton. Can we get full page and avoid overhead? */
 #define BULK_SIZE 512
-#define MAX_TRANSFER PAGE_SIZE*1
-#define WRITES_IN_FLIGHT (1)
+#define MAX_TRANSFER (PAGE_SIZE*16 - BULK_SIZE)
+#define DL_TRANSFER_MIN PAGE_SIZE
+#define DL_TRANSFER_MAX (PAGE_SIZE*64)
+#define WRITES_IN_FLIGHT (4)
+#define DL_URB_COUNT_MIN 2
+#define DL_URB_COUNT_MAX 32
+#define DL_AUTOTUNE_INTERVAL (HZ*2)
+#define DL_AUTOTUNE_SAMPLES 16 /* completions needed before retuning */
+#define DL_BENCH_PASSES 16 /* framebuffer encodes per buffer type */
 
 #define MAX_VENDOR_DESCRIPTOR_SIZE 256
 
 #define GET_URB_TIMEOUT	HZ
 #define FREE_URB_TIMEOUT (HZ*2)
 
-#define BPP                     2
 #define MAX_CMD_PIXELS		255
 
+/* frame transfer commands, see documentation/protocol.txt */
+#define DLFB_OP_RECT		0x01
+#define RECT_HEADER_BYTES	9
+#define DLFB_OP_BATCH		0x02
+#define SEGMENT_HEADER_BYTES	10 /* worst case, two 5-byte varints */
+#define MIN_SEGMENT_BYTES	16 /* don't split segments smaller */
+#define DLFB_OP_BATCH_RLE	0x03 /* followed by a format version byte */
+#define RLE_VERSION		1 /* see documentation/compression.txt */
+#define RLE_LEN_BYTES		3 /* padded varint, patched after encoding */
+#define RLE_MAX_SEGMENT		((1 << (7 * RLE_LEN_BYTES)) - 1) /* pixels */
+#define DLFB_OP_BATCH_DELTA	0x04 /* RLE batch of XOR against the sink */
+#define DL_DELTA_PIXELS		2048 /* delta encoded per segment, at most */
+#define DLFB_OP_COMPRESSED	0x05 /* codec and size, then a transfer */
+#define COMPRESS_LZ4		0x01 /* LZ4 block format */
+#define COMPRESS_HUFFMAN	0x02 /* canonical Huffman, table per transfer */
+#define COMPRESSED_HEADER_BYTES	7 /* op, codec, size as 5-byte varint */
+#define DLFB_OP_BATCH_MIXED	0x06 /* segments each name their codec */
+#define PALETTE_HEADER_BYTES	9 /* skip, codec, cols, rows, colours - 1 */
+#define DL_LOSSY_WINDOW_MS	250 /* send rate measured over this */
+#define DL_LOSSY_SETTLE_MS	200 /* unchanged this long, resend lossless */
+#define DL_PROGRESSIVE_PERCENT	25 /* of the tiles, for a flush to go coarse */
+#define DL_REFINE_TILES		64 /* refined per idle frame, at most */
+#define DL_BAND_BYTES		(1024*1024) /* segments encoded per band */
+#define DL_BAND_MIN_BYTES	(256*1024) /* damage less is encoded serially */
+#define DL_BAND_SEG_PIXELS	1024 /* per segment of a band, at most */
+#define DL_BAND_SEG_BYTES	(DL_BAND_SEG_PIXELS * BPP + \
+				 DL_BAND_SEG_PIXELS / RLE_MAX_COUNT + \
+				 SEGMENT_HEADER_BYTES)
+
+/* auto codec, see dlfb_auto_choose() */
+#define DL_RATIO_ONE		256 /* fixed point 1.0 for ratios */
+#define DL_AUTO_SLACK		16 /* ratios this close are a tie */
+#define DL_AUTO_TRY		32 /* flushes on a choice before trying another */
+#define DL_AUTO_HOT_MS		50 /* tiles updated this often ... */
+#define DL_AUTO_HOT_RATIO	224 /* ... and compressing worse go raw */
+#define DL_AUTO_LZ4_RATIO	224 /* batches compress whole below this */
+
+/*
+ * pixel encodings for batched transfers, selected in sysfs. The first
+ * DL_TILE_CODECS are also the segment codec values of mixed batches.
+ */
+enum dlfb_codec {
+	DLFB_CODEC_NONE,
+	DLFB_CODEC_RLE,
+	DLFB_CODEC_DELTA, /* needs the shadow buffer, else sent as RLE */
+	DLFB_CODEC_PALETTE, /* tiles of few colours, else sent as RLE */
+	DLFB_CODEC_LOSSY, /* hot tiles over bandwidth_target, not selectable */
+	DLFB_CODEC_FILTER, /* rows predicted from the left or above, then RLE */
+	DLFB_CODEC_LZ4, /* needs lib/lz4 in the kernel */
+	DLFB_CODEC_AUTO, /* per tile one of the DL_TILE_CODECS */
+	DLFB_CODEC_COUNT
+};
+
 #define RLX_HEADER_BYTES	7
 #define MIN_RLX_PIX_BYTES       4
 #define MIN_RLX_CMD_BYTES	(RLX_HEADER_BYTES + MIN_RLX_PIX_BYTES)
@@ -106,6 +278,12 @@ struct dlfb_data {
 #define MIN_RAW_PIX_BYTES	2
 #define MIN_RAW_CMD_BYTES	(RAW_HEADER_BYTES + MIN_RAW_PIX_BYTES)
 
+#define DL_TILE_SIZE		32 /* default damage tile edge, pixels */
+#define DL_TILE_SIZE_MIN	8
+#define DL_TILE_SIZE_MAX	128
+
+#define DL_FRAME_INTERVAL	msecs_to_jiffies(16) /* damage flush tick */
+
 #define DL_DEFIO_WRITE_DELAY    5 /* fb_deferred_io.delay in jiffies */
 #define DL_DEFIO_WRITE_DISABLE  (HZ*60) /* "disable" with long delay */
 
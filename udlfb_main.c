@@ -0,0 +1,4997 @@
+/*
+ * udlfb_main.c -- Framebuffer driver for DisplayLink USB controller
+ *
+ * Copyright (C) 2009 Roberto De Ioris <roberto@unbit.it>
+ * Copyright (C) 2009 Jaya Kumar <jayakumar.lkml@gmail.com>
+ * Copyright (C) 2009 Bernie Thompson <bernie@plugable.com>
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ *
+ * Layout is based on skeletonfb by James Simmons and Geert Uytterhoeven,
+ * usb-skeleton by GregKH.
+ *
+ * Device-specific portions based on information from Displaylink, with work
+ * from Florian Echtler, Henrik Bjerregaard Pedersen, and others.
+ */
+
+#define pr_fmt(fmt) "udlfb: " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/usb.h>
+#include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/fb.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/prefetch.h>
+#include <linux/delay.h>
+#include <linux/bitmap.h>
+#include <linux/ctype.h>
+#include <linux/log2.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+#include <linux/version.h> /* many users build as module against old kernels*/
+#include "udlfb.h"
+#include "devices.h"
+
+/* lib/lz4 came in 3.11, and is only built if something selects it */
+#if (defined(CONFIG_LZ4_COMPRESS) || defined(CONFIG_LZ4_COMPRESS_MODULE)) && \
+	(LINUX_VERSION_CODE >= KERNEL_VERSION(3, 11, 0))
+#include <linux/lz4.h>
+#define DLFB_LZ4 1
+#else
+#define DLFB_LZ4 0
+#endif
+
+// A temp var just to see how many times hline_render is being called.
+int vline_count = 0;
+
+unsigned char sony_sdmhs53_edid[] = {0x00, 0xff, 0xff,0xff,
+					0xff,0xff,0xff,0x00,0x4d,0xd9,0x50,0x22,
+					0x01,0x01,0x01,0x01,0x0b,0x0e,0x01,0x03,
+					0x0c,0x1e,0x17,0x78,0xea,0x8c,0x3e,0xa4,
+					0x58,0x4d,0x91,0x24,0x15,0x4f,0x51,0xa1,
+					0x08,0x00,0x01,0x01,0x01,0x01,0x01,0x01,
+					0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+					0x01,0x01,0x64,0x19,0x00,0x40,0x41,0x00,
+					0x26,0x30,0x18,0x88,0x36,0x00,0x30,0xe4,
+					0x10,0x00,0x00,0x18,0x00,0x00,0x00,0xfd,
+					0x00,0x39,0x3f,0x1c,0x31,0x09,0x00,0x0a,
+					0x20,0x20,0x20,0x20,0x20,0x20,0x00,0x00,
+					0x00,0xfc,0x00,0x53,0x44,0x4d,0x2d,0x48,
+					0x53,0x35,0x33,0x0a,0x20,0x20,0x20,0x20,
+					0x00,0x00,0x00,0xff,0x00,0x31,0x32,0x35,
+					0x33,0x37,0x30,0x36,0x0a,0x20,0x20,0x20,
+					0x20,0x20,0x00,0xce,
+};
+
+static struct fb_fix_screeninfo dlfb_fix = {
+	.id =           "udlfb",
+	.type =         FB_TYPE_PACKED_PIXELS,
+	.visual =       FB_VISUAL_TRUECOLOR,
+	.xpanstep =     0,
+	.ypanstep =     0,
+	.ywrapstep =    0,
+	.accel =        FB_ACCEL_NONE,
+};
+
+static const u32 udlfb_info_flags = FBINFO_DEFAULT | FBINFO_READS_FAST |
+#ifdef FBINFO_VIRTFB
+		FBINFO_VIRTFB |
+#endif
+		FBINFO_HWACCEL_IMAGEBLIT | FBINFO_HWACCEL_FILLRECT |
+		FBINFO_HWACCEL_COPYAREA | FBINFO_MISC_ALWAYS_SETPAR;
+
+/*
+ * There are many DisplayLink-based graphics products, all with unique PIDs.
+ * So we match on DisplayLink's VID + Vendor-Defined Interface Class (0xff)
+ * We also require a match on SubClass (0x00) and Protocol (0x00),
+ * which is compatible with all known USB 2.0 era graphics chips and firmware,
+ * but allows DisplayLink to increment those for any future incompatible chips
+ */
+static struct usb_device_id id_table[] = {
+	{.idVendor = 0x17e9,
+	 .bInterfaceClass = 0xff,
+	 .bInterfaceSubClass = 0x00,
+	 .bInterfaceProtocol = 0x00,
+	 .match_flags = USB_DEVICE_ID_MATCH_VENDOR |
+		USB_DEVICE_ID_MATCH_INT_CLASS |
+		USB_DEVICE_ID_MATCH_INT_SUBCLASS |
+		USB_DEVICE_ID_MATCH_INT_PROTOCOL,
+	},
+	{ USB_DEVICE_AND_INTERFACE_INFO(VID1, PID1, CL1, SC1, PR1) },
+	{ USB_DEVICE_AND_INTERFACE_INFO(VID1, 0x2d00, CL1, SC1, PR1) },
+	{},
+};
+MODULE_DEVICE_TABLE(usb, id_table);
+
+/* module options */
+static bool console = 1; /* Allow fbcon to open framebuffer */
+static bool fb_defio = 1;  /* Detect mmap writes using page faults */
+static bool shadow = 1; /* Optionally disable shadow framebuffer */
+static int pixel_limit; /* Optionally force a pixel resolution limit */
+static int tile_size = DL_TILE_SIZE; /* Damage tracking granularity */
+static bool batch = 1; /* Pack many segments into each transfer */
+static int transfer_size = MAX_TRANSFER; /* Bytes per urb */
+static bool zero_copy = 1; /* Send big updates straight from memory */
+static bool streaming_dma; /* Cached urb buffers, synced at submit */
+
+/* encode threads of all devices, bands of big flushes run here */
+static struct workqueue_struct *dlfb_encode_wq;
+
+/*
+ * When building as a separate module against an arbitrary kernel,
+ * check on build presence of other kernel modules we have dependencies on.
+ * In some cases we can't build at all without the dependency.
+ * For others, we can build without them, but lose functionality.
+ * When rebuilding entire kernel, our Kconfig should pull in everything we need.
+ */
+
+#ifndef CONFIG_FB_DEFERRED_IO
+#warning CONFIG_FB_DEFERRED_IO kernel support required for fb_defio mmap support
+#endif
+
+#ifndef CONFIG_FB_SYS_IMAGEBLIT
+#warning CONFIG_FB_SYS_IMAGEBLIT kernel support required for fb console
+#endif
+
+#ifndef CONFIG_FB_SYS_FOPS
+#warning FB_SYS_FOPS kernel support required for filesystem char dev access
+#endif
+
+#ifndef CONFIG_FB_MODE_HELPERS
+#warning CONFIG_FB_MODE_HELPERS required. Expect build break
+#endif
+
+/* dlfb keeps a list of urbs for efficient bulk transfers */
+static void dlfb_urb_completion(struct urb *urb);
+static struct urb *dlfb_get_urb(struct dlfb_data *dev);
+static struct urb *dlfb_try_get_urb(struct dlfb_data *dev);
+static void dlfb_urb_returned(struct dlfb_data *dev);
+static int dlfb_submit_urb(struct dlfb_data *dev, struct urb * urb, size_t len);
+static void dlfb_release_urb(struct dlfb_data *dev, struct urb *urb);
+static int dlfb_alloc_urb_list(struct dlfb_data *dev, int count, size_t size);
+static void dlfb_free_urb_list(struct dlfb_data *dev);
+static int dlfb_resize_urb_list(struct dlfb_data *dev, int count, size_t size);
+static int dlfb_hold_urbs(struct dlfb_data *dev);
+static void dlfb_unhold_urbs(struct dlfb_data *dev);
+static size_t dlfb_transfer_size(struct dlfb_data *dev, int size);
+static void dlfb_mark_damage(struct dlfb_data *dev, int x, int y,
+			     int width, int height, bool resend);
+
+
+/* Function added by me to fix make errors */
+static void err (char *msg){
+	printk(msg);
+}
+
+/*
+ * All DisplayLink bulk operations start with 0xAF, followed by specific code
+ * All operations are written to buffers which then later get sent to device
+ */
+static char *dlfb_set_register(char *buf, u8 reg, u8 val)
+{
+	printk("dlfb_set_register called\n");
+	*buf++ = reg;
+	*buf++ = val;
+	return buf;
+}
+
+static char *dlfb_vidreg_lock(char *buf)
+{
+	printk("dlfb_vidreg_lock called \n");
+	return dlfb_set_register(buf, 0xFF, 0x00);
+}
+
+static char *dlfb_vidreg_unlock(char *buf)
+{
+	printk("dlfb_vidreg_unlock called \n");
+	return dlfb_set_register(buf, 0xFF, 0xFF);
+}
+
+/*
+ * Map FB_BLANK_* to DisplayLink register
+ * DLReg FB_BLANK_*
+ * ----- -----------------------------
+ *  0x00 FB_BLANK_UNBLANK (0)
+ *  0x01 FB_BLANK (1)
+ *  0x03 FB_BLANK_VSYNC_SUSPEND (2)
+ *  0x05 FB_BLANK_HSYNC_SUSPEND (3)
+ *  0x07 FB_BLANK_POWERDOWN (4) Note: requires modeset to come back
+ */
+static char *dlfb_blanking(char *buf, int fb_blank)
+{
+	u8 reg;
+	
+	printk("dlfb_blanking called \n");
+
+	switch (fb_blank) {
+	case FB_BLANK_POWERDOWN:
+		reg = 0x07;
+		break;
+	case FB_BLANK_HSYNC_SUSPEND:
+		reg = 0x05;
+		break;
+	case FB_BLANK_VSYNC_SUSPEND:
+		reg = 0x03;
+		break;
+	case FB_BLANK_NORMAL:
+		reg = 0x01;
+		break;
+	default:
+		reg = 0x00;
+	}
+
+	buf = dlfb_set_register(buf, 0x1F, reg);
+
+	return buf;
+}
+
+static char *dlfb_set_color_depth(char *buf, u8 selection)
+{
+	printk("dlfb_set_color_depth called\n");
+	return dlfb_set_register(buf, 0x00, selection);
+}
+
+static char *dlfb_set_base16bpp(char *wrptr, u32 base)
+{
+	printk("dlfb_set_base16bpp called\n");
+	/* the base pointer is 16 bits wide, 0x20 is hi byte. */
+	wrptr = dlfb_set_register(wrptr, 0x20, base >> 16);
+	wrptr = dlfb_set_register(wrptr, 0x21, base >> 8);
+	return dlfb_set_register(wrptr, 0x22, base);
+}
+
+/*
+ * DisplayLink HW has separate 16bpp and 8bpp framebuffers.
+ * In 24bpp modes, the low 323 RGB bits go in the 8bpp framebuffer
+ */
+static char *dlfb_set_base8bpp(char *wrptr, u32 base)
+{
+	printk("dlfb_set_base8bpp called\n");
+	wrptr = dlfb_set_register(wrptr, 0x26, base >> 16);
+	wrptr = dlfb_set_register(wrptr, 0x27, base >> 8);
+	return dlfb_set_register(wrptr, 0x28, base);
+}
+
+static char *dlfb_set_register_16(char *wrptr, u8 reg, u16 value)
+{
+	printk("dlfb_set_register_16 called\n");
+	wrptr = dlfb_set_register(wrptr, reg, value >> 8);
+	return dlfb_set_register(wrptr, reg+1, value);
+}
+
+/*
+ * This is kind of weird because the controller takes some
+ * register values in a different byte order than other registers.
+ */
+static char *dlfb_set_register_16be(char *wrptr, u8 reg, u16 value)
+{
+	printk("dlfb_set_register_16be called\n");
+	wrptr = dlfb_set_register(wrptr, reg, value);
+	return dlfb_set_register(wrptr, reg+1, value >> 8);
+}
+
+/*
+ * LFSR is linear feedback shift register. The reason we have this is
+ * because the display controller needs to minimize the clock depth of
+ * various counters used in the display path. So this code reverses the
+ * provided value into the lfsr16 value by counting backwards to get
+ * the value that needs to be set in the hardware comparator to get the
+ * same actual count. This makes sense once you read above a couple of
+ * times and think about it from a hardware perspective.
+ */
+static u16 dlfb_lfsr16(u16 actual_count)
+{
+	u32 lv = 0xFFFF; /* This is the lfsr value that the hw starts with */
+	printk("dlfb_lfsr16 called\n");
+
+	while (actual_count--) {
+		lv =	 ((lv << 1) |
+			(((lv >> 15) ^ (lv >> 4) ^ (lv >> 2) ^ (lv >> 1)) & 1))
+			& 0xFFFF;
+	}
+
+	return (u16) lv;
+}
+
+/*
+ * This does LFSR conversion on the value that is to be written.
+ * See LFSR explanation above for more detail.
+ */
+static char *dlfb_set_register_lfsr16(char *wrptr, u8 reg, u16 value)
+{
+	printk("dlfb_set_register_lfsr16 called\n");
+	return dlfb_set_register_16(wrptr, reg, dlfb_lfsr16(value));
+}
+
+/*
+ * This takes a standard fbdev screeninfo struct and all of its monitor mode
+ * details and converts them into the DisplayLink equivalent register commands.
+ */
+static char *dlfb_set_vid_cmds(char *wrptr, struct fb_var_screeninfo *var)
+{
+	u16 xds, yds;
+	u16 xde, yde;
+	u16 yec;
+	
+	printk("dlfb_set_vid_cmds called\n");
+
+	/* x display start */
+	xds = var->left_margin + var->hsync_len;
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x01, xds);
+	/* x display end */
+	xde = xds + var->xres;
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x03, xde);
+
+	/* y display start */
+	yds = var->upper_margin + var->vsync_len;
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x05, yds);
+	/* y display end */
+	yde = yds + var->yres;
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x07, yde);
+
+	/* x end count is active + blanking - 1 */
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x09,
+			xde + var->right_margin - 1);
+
+	/* libdlo hardcodes hsync start to 1 */
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x0B, 1);
+
+	/* hsync end is width of sync pulse + 1 */
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x0D, var->hsync_len + 1);
+
+	/* hpixels is active pixels */
+	wrptr = dlfb_set_register_16(wrptr, 0x0F, var->xres);
+
+	/* yendcount is vertical active + vertical blanking */
+	yec = var->yres + var->upper_margin + var->lower_margin +
+			var->vsync_len;
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x11, yec);
+
+	/* libdlo hardcodes vsync start to 0 */
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x13, 0);
+
+	/* vsync end is width of vsync pulse */
+	wrptr = dlfb_set_register_lfsr16(wrptr, 0x15, var->vsync_len);
+
+	/* vpixels is active pixels */
+	wrptr = dlfb_set_register_16(wrptr, 0x17, var->yres);
+
+	/* convert picoseconds to 5kHz multiple for pclk5k = x * 1E12/5k */
+	wrptr = dlfb_set_register_16be(wrptr, 0x1B,
+			200*1000*1000/var->pixclock);
+
+	return wrptr;
+}
+
+/*
+ * This takes a standard fbdev screeninfo struct that was fetched or prepared
+ * and then generates the appropriate command sequence that then drives the
+ * display controller.
+ */
+static int dlfb_set_video_mode(struct dlfb_data *dev,
+				struct fb_var_screeninfo *var)
+{
+	char *buf;
+	char *wrptr;
+	int retval = 0;
+	int writesize;
+	struct urb *urb;
+	
+	printk("dlfb_set_video_mode called\n");
+
+	if (!atomic_read(&dev->video.usb_active))
+		return -EPERM;
+
+	urb = dlfb_get_urb(dev);
+	if (!urb)
+		return -ENOMEM;
+
+	buf = (char *) urb->transfer_buffer;
+
+	/*
+	* This first section has to do with setting the base address on the
+	* controller * associated with the display. There are 2 base
+	* pointers, currently, we only * use the 16 bpp segment.
+	*/
+	wrptr = dlfb_vidreg_lock(buf);
+	wrptr = dlfb_set_color_depth(wrptr, 0x00);
+	/* set base for 16bpp segment to 0 */
+	wrptr = dlfb_set_base16bpp(wrptr, 0);
+	/* set base for 8bpp segment to end of fb */
+	wrptr = dlfb_set_base8bpp(wrptr, dev->video.info->fix.smem_len);
+
+	wrptr = dlfb_set_vid_cmds(wrptr, var);
+	wrptr = dlfb_blanking(wrptr, FB_BLANK_UNBLANK);
+	wrptr = dlfb_vidreg_unlock(wrptr);
+
+	writesize = wrptr - buf;
+
+	
+	printk("Writesize in video mode set: %d\n", writesize);
+	/* 
+	 * This accounts for 72 Bytes
+	 * The sink only understands frame data, so register writes are
+	 * built but not sent. Hand the urb straight back to the pool.
+	 * -TODO- Ensure the driver without such restriction
+	 */
+	dlfb_release_urb(dev, urb);
+
+	dev->video.blank_mode = FB_BLANK_UNBLANK;
+
+	return retval;
+}
+
+static int dlfb_ops_mmap(struct fb_info *info, struct vm_area_struct *vma)
+{
+	unsigned long start = vma->vm_start;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long page, pos;
+	
+	printk("dlfb_ops_mmap called\n");
+
+	if (offset + size > info->fix.smem_len)
+		return -EINVAL;
+
+	pos = (unsigned long)info->fix.smem_start + offset;
+
+	pr_notice("mmap() framebuffer addr:%lu size:%lu\n",
+		  pos, size);
+
+	while (size > 0) {
+		page = vmalloc_to_pfn((void *)pos);
+		if (remap_pfn_range(vma, start, page, PAGE_SIZE, PAGE_SHARED))
+			return -EAGAIN;
+
+		start += PAGE_SIZE;
+		pos += PAGE_SIZE;
+		if (size > PAGE_SIZE)
+			size -= PAGE_SIZE;
+		else
+			size = 0;
+	}
+
+	vma->vm_flags |= VM_RESERVED;	/* avoid to swap out this VMA */
+	return 0;
+}
+
+/*
+ * Without batching, every frame transfer is a rectangle command: the op
+ * byte, x, y, width and height as little endian 16 bit values, then
+ * width * height pixels packed row after row.
+ * See documentation/protocol.txt
+ */
+static char *dlfb_rect_header(char *buf, int x, int y, int width, int height)
+{
+	*buf++ = DLFB_OP_RECT;
+	*buf++ = x;
+	*buf++ = x >> 8;
+	*buf++ = y;
+	*buf++ = y >> 8;
+	*buf++ = width;
+	*buf++ = width >> 8;
+	*buf++ = height;
+	*buf++ = height >> 8;
+	return buf;
+}
+
+/*
+ * Shrink a rectangle to the bounding box of pixels that differ from the
+ * shadow buffer. Rows whose start isn't word aligned are taken as fully
+ * changed, as is any trailing partial word of a row.
+ * Returns the number of identical bytes cut away.
+ */
+static int dlfb_trim_rect(struct dlfb_data *dev, int *x, int *y,
+			  int *width, int *height)
+{
+	struct fb_info *info = dev->video.info;
+	const u8 *front = (const u8 *) info->fix.smem_start;
+	const u8 *back = (const u8 *) dev->video.backing_buffer;
+	const u32 line_length = info->fix.line_length;
+	const int row_bytes = *width * BPP;
+	const int word_bytes = row_bytes & ~(sizeof(unsigned long) - 1);
+	const int area = *width * *height;
+	int first_row = -1, last_row = -1;
+	int min_start = row_bytes, max_end = 0;
+	int row;
+
+	for (row = 0; row < *height; row++) {
+		const u32 offset = line_length * (*y + row) + *x * BPP;
+		const u8 *changed = front + offset;
+		int start, end;
+		int changed_len = word_bytes;
+
+		if (IS_ALIGNED(offset, sizeof(unsigned long))) {
+			dlfb_trim_hline(back + offset, &changed, &changed_len);
+			start = changed - (front + offset);
+			end = start + changed_len;
+			if (!changed_len)
+				start = word_bytes;
+			if ((word_bytes < row_bytes) &&
+			    memcmp(front + offset + word_bytes,
+				   back + offset + word_bytes,
+				   row_bytes - word_bytes)) {
+				start = min(start, word_bytes);
+				end = row_bytes;
+			}
+		} else {
+			start = 0;
+			end = row_bytes;
+		}
+
+		if (start >= end)
+			continue;
+
+		if (first_row < 0)
+			first_row = row;
+		last_row = row;
+		min_start = min(min_start, start);
+		max_end = max(max_end, end);
+	}
+
+	if (first_row < 0) {
+		*width = *height = 0;
+		return area * BPP;
+	}
+
+	*x += min_start / BPP;
+	*y += first_row;
+	*width = DIV_ROUND_UP(max_end, BPP) - min_start / BPP;
+	*height = last_row - first_row + 1;
+
+	return (area - *width * *height) * BPP;
+}
+
+/*
+ * Remember a region an urb carries, so it can be sent again if the urb
+ * fails. Regions merge into a short list as damage areas do.
+ */
+static void dlfb_urb_carries(struct urb *urb, int x, int y,
+			     int width, int height)
+{
+	struct urb_node *unode = urb->context;
+	struct dloarea area;
+
+	area.x = x;
+	area.y = y;
+	area.w = width;
+	area.h = height;
+	area.x2 = x + width;
+	area.y2 = y + height;
+
+	dlfb_merge_area(unode->areas, &unode->area_count, DL_URB_AREAS, area);
+}
+
+/* As above, for a span of the framebuffer in memory order */
+static void dlfb_urb_carries_span(struct dlfb_data *dev, struct urb *urb,
+				  u32 byte_offset, u32 byte_len)
+{
+	const u32 line_length = dev->video.info->fix.line_length;
+	const u32 first_line = byte_offset / line_length;
+	const u32 last_line = (byte_offset + byte_len - 1) / line_length;
+
+	if (first_line == last_line)
+		dlfb_urb_carries(urb, (byte_offset % line_length) / BPP,
+				 first_line, DIV_ROUND_UP(byte_len, BPP), 1);
+	else
+		dlfb_urb_carries(urb, 0, first_line,
+				 dev->video.info->var.xres,
+				 last_line - first_line + 1);
+}
+
+/*
+ * There are 3 copies of every pixel: The front buffer that the fbdev
+ * client renders to, the actual framebuffer across the USB bus in hardware
+ * (that we can only write to, slowly, and can never read), and (optionally)
+ * our shadow copy that tracks what's been sent to that hardware buffer.
+ *
+ * The rectangle is sent as bands of whole rows that fit one urb each,
+ * reading the framebuffer with its line stride. Transfers are queued
+ * asynchronously; we only block when every urb is in flight.
+ */
+static int dlfb_render_rect(struct dlfb_data *dev, int x, int y,
+			    int width, int height, bool trim,
+			    int *ident_ptr, int *sent_ptr)
+{
+	struct fb_info *info = dev->video.info;
+	const char *front = (const char *) info->fix.smem_start;
+	char *back = dev->video.backing_buffer;
+	const u32 line_length = info->fix.line_length;
+	const int max_pixels = (dev->video.urbs.size - RECT_HEADER_BYTES) / BPP;
+	int band_x, band_y, band_width, band_height, row;
+
+	if (back && trim)
+		*ident_ptr += dlfb_trim_rect(dev, &x, &y, &width, &height);
+
+	/* rows wider than an urb are split into columns as well */
+	for (band_x = x; band_x < x + width; band_x += band_width) {
+		band_width = min(x + width - band_x, max_pixels);
+
+		for (band_y = y; band_y < y + height; band_y += band_height) {
+			struct urb *urb;
+			char *cmd;
+
+			band_height = min(y + height - band_y,
+					  max_pixels / band_width);
+
+			urb = dlfb_try_get_urb(dev);
+			if (!urb)
+				return 1;
+
+			cmd = dlfb_rect_header((char *) urb->transfer_buffer,
+					       band_x, band_y,
+					       band_width, band_height);
+			dlfb_urb_carries(urb, band_x, band_y,
+					 band_width, band_height);
+			for (row = band_y; row < band_y + band_height; row++) {
+				memcpy(cmd, front + line_length * row +
+				       band_x * BPP, band_width * BPP);
+				cmd += band_width * BPP;
+			}
+
+			if (dlfb_submit_urb(dev, urb,
+					    cmd - (char *) urb->transfer_buffer))
+				return 1;
+
+			if (back) {
+				for (row = band_y; row < band_y + band_height;
+				     row++) {
+					const u32 offset = line_length * row +
+						band_x * BPP;
+
+					memcpy(back + offset, front + offset,
+					       band_width * BPP);
+				}
+			}
+
+			*sent_ptr += cmd - (char *) urb->transfer_buffer;
+		}
+	}
+
+	return 0;
+}
+
+/* Where the batch for urb is written: staged to be compressed, or in place */
+static char *dlfb_batch_buf(struct dlfb_data *dev, struct urb *urb)
+{
+	struct urb_node *unode = urb->context;
+
+	switch (unode->packed) {
+	case COMPRESS_LZ4:
+		return dev->video.lz4_buf;
+	case COMPRESS_HUFFMAN:
+		return dev->video.huff_buf;
+	default:
+		return urb->transfer_buffer;
+	}
+}
+
+/* Room is left for the compressed header, so the batch can go out as is */
+static char *dlfb_batch_end(struct dlfb_data *dev, struct urb *urb)
+{
+	struct urb_node *unode = urb->context;
+
+	if (unode->packed)
+		return dlfb_batch_buf(dev, urb) + dev->video.urbs.size -
+			COMPRESSED_HEADER_BYTES;
+	return (char *) urb->transfer_buffer + dev->video.urbs.size;
+}
+
+#if DLFB_LZ4
+/*
+ * LZ4 block of src in dst, or 0 if it won't fit in dst_len. Before 4.11
+ * lib/lz4 can't bound its output, so it goes through lz4_out first.
+ */
+static size_t dlfb_lz4_compress(struct dlfb_data *dev, const char *src,
+				size_t src_len, char *dst, size_t dst_len)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+	return LZ4_compress_default(src, dst, src_len, dst_len,
+				    dev->video.lz4_wrkmem);
+#else
+	size_t out_len;
+
+	if (lz4_compress(src, src_len, dev->video.lz4_out, &out_len,
+			 dev->video.lz4_wrkmem) || (out_len > dst_len))
+		return 0;
+	memcpy(dst, dev->video.lz4_out, out_len);
+	return out_len;
+#endif
+}
+#endif
+
+/*
+ * Fill urb from the batch staged for it: a DLFB_OP_COMPRESSED header
+ * with the codec and the batch's size, then the batch as an LZ4 block
+ * or Huffman coded. If that comes out no smaller the batch is sent as
+ * it is. Returns the transfer length.
+ */
+static int dlfb_packed_transfer(struct dlfb_data *dev, struct urb *urb,
+				int len)
+{
+	struct urb_node *unode = urb->context;
+	const char *staged = dlfb_batch_buf(dev, urb);
+	char *buf = urb->transfer_buffer;
+	char *cmd = buf;
+	size_t packed = 0;
+
+	*cmd++ = DLFB_OP_COMPRESSED;
+	*cmd++ = unode->packed;
+	cmd = dlfb_put_varint(cmd, len);
+	if ((len > cmd - buf) && (unode->packed == COMPRESS_HUFFMAN))
+		packed = dlfb_huffman_compress(dev->video.huff, staged, len,
+					       cmd, len - (cmd - buf));
+#if DLFB_LZ4
+	else if (len > cmd - buf)
+		packed = dlfb_lz4_compress(dev, staged, len, cmd,
+					   len - (cmd - buf));
+#endif
+	if (!packed) {
+		memcpy(buf, staged, len);
+		return len;
+	}
+
+	return cmd - buf + packed;
+}
+
+/*
+ * Whether to compress the next auto batch whole. Kept up while LZ4 pays,
+ * and tried every DL_AUTO_TRY batches when it hasn't been.
+ */
+static bool dlfb_auto_lz4(struct beaglevideo *video)
+{
+	if (!video->lz4_buf)
+		return false;
+	if (video->lz4_ratio < DL_AUTO_LZ4_RATIO)
+		return true;
+	return !(++video->lz4_skipped % DL_AUTO_TRY);
+}
+
+/*
+ * Batched transfers start with DLFB_OP_BATCH and then carry as many
+ * segments as fit. Each segment is a run of consecutive framebuffer
+ * pixels: varint distance in pixels from the end of the previous
+ * segment in this transfer (from pixel 0 for the first), varint length
+ * in pixels, then the pixels. With RLE the transfer starts with
+ * DLFB_OP_BATCH_RLE and the format version, and the pixels of each
+ * segment are RLE encoded. Delta batches are the same with
+ * DLFB_OP_BATCH_DELTA, and encode new pixels XORed with the old.
+ * LZ4 batches are plain batches staged in lz4_buf, compressed into the
+ * urb when they end. Auto batches are DLFB_OP_BATCH_MIXED, and each
+ * segment says after its skip how it is encoded. With entropy set, the
+ * encoded kinds are staged in huff_buf and Huffman coded as they end.
+ */
+static int dlfb_start_batch(struct dlfb_data *dev, struct urb **urb_ptr,
+			    char **urb_buf_ptr, int codec)
+{
+	struct urb *urb = dlfb_try_get_urb(dev);
+	struct urb_node *unode;
+	char *cmd;
+
+	if (!urb)
+		return 1;
+
+	unode = urb->context;
+	unode->seg_end = 0;
+	unode->codec = codec;
+	if ((codec == DLFB_CODEC_LZ4) ||
+	    ((codec == DLFB_CODEC_AUTO) && dlfb_auto_lz4(&dev->video)))
+		unode->packed = COMPRESS_LZ4;
+	else if (dev->video.entropy && (codec != DLFB_CODEC_NONE))
+		unode->packed = COMPRESS_HUFFMAN;
+	else
+		unode->packed = 0;
+
+	cmd = dlfb_batch_buf(dev, urb);
+	switch (codec) {
+	case DLFB_CODEC_RLE:
+		*cmd++ = DLFB_OP_BATCH_RLE;
+		*cmd++ = RLE_VERSION;
+		break;
+	case DLFB_CODEC_DELTA:
+		*cmd++ = DLFB_OP_BATCH_DELTA;
+		*cmd++ = RLE_VERSION;
+		break;
+	case DLFB_CODEC_AUTO:
+		*cmd++ = DLFB_OP_BATCH_MIXED;
+		*cmd++ = RLE_VERSION;
+		break;
+	default:
+		*cmd++ = DLFB_OP_BATCH;
+		break;
+	}
+
+	*urb_ptr = urb;
+	*urb_buf_ptr = cmd;
+	return 0;
+}
+
+/*
+ * Submit the batch being filled, or give its urb back if it is empty
+ */
+static int dlfb_end_batch(struct dlfb_data *dev, struct urb **urb_ptr,
+			  char **urb_buf_ptr, int *sent_ptr)
+{
+	struct urb *urb = *urb_ptr;
+	struct urb_node *unode = urb->context;
+	int len = *urb_buf_ptr - dlfb_batch_buf(dev, urb);
+	int ret = 0;
+
+	*urb_ptr = NULL;
+
+	/* every segment ends past pixel 0, so none were added */
+	if (!unode->seg_end) {
+		dlfb_release_urb(dev, urb);
+		return 0;
+	}
+
+	if (unode->packed) {
+		const int staged = len;
+		u16 *ratio = (unode->packed == COMPRESS_LZ4) ?
+			&dev->video.lz4_ratio : &dev->video.huff_ratio;
+
+		len = dlfb_packed_transfer(dev, urb, staged);
+		*ratio = *ratio - *ratio / 8 + len * DL_RATIO_ONE / staged / 8;
+		if (unode->packed == COMPRESS_LZ4)
+			dev->video.lz4_skipped = 0;
+	}
+
+	ret = dlfb_submit_urb(dev, urb, len);
+	if (!ret)
+		*sent_ptr += len;
+	return ret;
+}
+
+/* Whether batches are mixed, with the codec chosen tile by tile */
+static bool dlfb_mixed(struct beaglevideo *video)
+{
+	return (video->codec == DLFB_CODEC_AUTO) ||
+		(video->codec == DLFB_CODEC_PALETTE) ||
+		(video->codec == DLFB_CODEC_FILTER);
+}
+
+/*
+ * A delta is only right if the shadow buffer holds what the sink shows.
+ * That isn't so for regions resent after a failed transfer (trim is
+ * false for those), nor without a shadow: they go out as plain RLE,
+ * which also brings the sink back in step.
+ */
+static int dlfb_segment_codec(struct dlfb_data *dev, int codec, bool trim)
+{
+	if ((codec == DLFB_CODEC_DELTA) &&
+	    !(dev->video.backing_buffer && trim))
+		return DLFB_CODEC_RLE;
+	return codec;
+}
+
+/*
+ * The row above byte_offset as the sink has it, for the up and copy
+ * filters, or NULL. That needs the shadow in step (up), and the row to
+ * be in the same tile: the row above in another tile may be waiting on
+ * a resend.
+ */
+static const u16 *dlfb_row_above(struct dlfb_data *dev, u32 byte_offset,
+				 bool up)
+{
+	struct beaglevideo *video = &dev->video;
+	const u32 line_length = video->info->fix.line_length;
+	const u32 tile_mask = (1 << video->tile_shift) - 1;
+
+	if (!up || !((byte_offset / line_length) & tile_mask))
+		return NULL;
+	return (const u16 *) (video->backing_buffer + byte_offset -
+			      line_length);
+}
+
+/*
+ * Trim a span of the framebuffer to the part that differs from the
+ * shadow, moving line_start, byte_offset and byte_width along with it.
+ * Returns the number of identical bytes cut away.
+ */
+static int dlfb_trim_span(struct dlfb_data *dev, const u8 **line_start,
+			  u32 *byte_offset, u32 *byte_width)
+{
+	const u8 *changed = *line_start;
+	int changed_len = *byte_width;
+	int ident;
+
+	if (!IS_ALIGNED(*byte_offset | *byte_width, sizeof(unsigned long)))
+		return 0;
+
+	ident = dlfb_trim_hline((u8 *) dev->video.backing_buffer +
+				*byte_offset, &changed, &changed_len);
+	*byte_offset += changed - *line_start;
+	*byte_width = changed_len;
+	*line_start = changed;
+	return ident;
+}
+
+/*
+ * Encode the start of a span as one segment, everything after its skip
+ * (and codec, in mixed batches), into cmd up to cmd_end. The shadow, if
+ * there is one, is brought up to what the sink will have. scratch holds
+ * DL_DELTA_PIXELS, for the delta and filter residuals. Sets *used to
+ * the framebuffer bytes the segment covers; returns the end of it.
+ */
+static char *dlfb_encode_segment(struct dlfb_data *dev, char *cmd,
+				 const char *cmd_end, const u8 *line_start,
+				 u32 byte_offset, u32 byte_width, bool trim,
+				 int codec, u16 *scratch, u32 *used)
+{
+	char *back = dev->video.backing_buffer;
+	const u32 line_length = dev->video.info->fix.line_length;
+	u32 len;
+
+	if ((codec == DLFB_CODEC_NONE) || (codec == DLFB_CODEC_LZ4)) {
+		len = min_t(u32, byte_width, (cmd_end - cmd -
+			    SEGMENT_HEADER_BYTES) & ~(BPP - 1));
+		cmd = dlfb_put_varint(cmd, len / BPP);
+		memcpy(cmd, line_start, len);
+		cmd += len;
+		if (back)
+			memcpy(back + byte_offset, line_start, len);
+	} else if (codec == DLFB_CODEC_LOSSY) {
+		const int depth = dev->video.flush_depth;
+		const u32 room = cmd_end - cmd - SEGMENT_HEADER_BYTES;
+		const u32 pixels = min_t(u32, byte_width / BPP,
+					 (depth == LOSSY_RGB444) ?
+					 room * 2 / 3 : room);
+
+		*cmd++ = depth;
+		cmd = dlfb_put_varint(cmd, pixels);
+		cmd = dlfb_lossy_encode(cmd, (const u16 *) line_start,
+			back ? (u16 *) (back + byte_offset) : NULL,
+			(byte_offset % line_length) / BPP,
+			byte_offset / line_length, pixels, depth);
+		len = pixels * BPP;
+	} else if (codec == DLFB_CODEC_FILTER) {
+		const u16 *src = (const u16 *) line_start;
+		u32 pixels = min_t(u32, byte_width / BPP,
+				   DL_DELTA_PIXELS);
+		const u16 *above = dlfb_row_above(dev, byte_offset,
+						  back && trim);
+		const int filter = dlfb_row_filter(src, above, pixels,
+						   scratch);
+
+		*cmd++ = filter;
+		if (filter == ROW_FILTER_COPY) {
+			cmd = dlfb_put_varint(cmd, pixels);
+		} else {
+			char *len_ptr = cmd;
+
+			if (filter != ROW_FILTER_NONE)
+				src = scratch;
+			cmd = dlfb_rle_encode(cmd + RLE_LEN_BYTES,
+					      cmd_end, src, &pixels);
+			dlfb_put_varint_fixed(len_ptr, pixels,
+					      RLE_LEN_BYTES);
+		}
+		len = pixels * BPP;
+
+		if (back)
+			dlfb_row_unfilter(filter,
+					  (const u16 *) line_start,
+					  scratch, above,
+					  (u16 *) (back + byte_offset),
+					  pixels);
+		atomic_inc(&dev->video.filter_rows[filter]);
+	} else {
+		const u16 *src = (const u16 *) line_start;
+		char *len_ptr = cmd;
+		u32 pixels = min_t(u32, byte_width / BPP,
+				   RLE_MAX_SEGMENT);
+
+		/*
+		 * Unchanged pixels XOR to zero and make long runs.
+		 * The front buffer is read once, into the delta,
+		 * so the shadow gets exactly what the sink will.
+		 */
+		if (codec == DLFB_CODEC_DELTA) {
+			pixels = min_t(u32, pixels, DL_DELTA_PIXELS);
+			dlfb_xor_pixels(scratch,
+					line_start, back + byte_offset,
+					pixels);
+			src = scratch;
+		}
+
+		cmd = dlfb_rle_encode(cmd + RLE_LEN_BYTES, cmd_end,
+				      src, &pixels);
+		dlfb_put_varint_fixed(len_ptr, pixels, RLE_LEN_BYTES);
+		len = pixels * BPP;
+
+		if (codec == DLFB_CODEC_DELTA)
+			dlfb_xor_pixels(back + byte_offset,
+					back + byte_offset,
+					scratch, pixels);
+		else if (back)
+			memcpy(back + byte_offset, line_start, len);
+	}
+
+	*used = len;
+	return cmd;
+}
+
+/*
+ * Append one span of the framebuffer to the current batch as segments,
+ * starting new transfers as each one fills. With a shadow buffer the
+ * span is first trimmed to the part that changed. codec is how the
+ * segments are encoded, from dlfb_segment_codec(); with the auto codec
+ * what they came to is added up in stat.
+ */
+static int dlfb_render_hline(struct dlfb_data *dev, struct urb **urb_ptr,
+			      const char *front, char **urb_buf_ptr,
+			      u32 byte_offset, u32 byte_width, bool trim,
+			      int codec, struct dlfb_tile_stat *stat,
+			      int *ident_ptr, int *sent_ptr)
+{
+	const u8 *line_start = (const u8 *) front + byte_offset;
+	const int batch_codec = dlfb_mixed(&dev->video) ?
+		DLFB_CODEC_AUTO : codec;
+	struct urb_node *unode;
+
+	if (dev->video.backing_buffer && trim)
+		*ident_ptr += dlfb_trim_span(dev, &line_start, &byte_offset,
+					     &byte_width);
+
+	/* a transfer holds one kind of batch, with skips that never go back */
+	if (*urb_ptr && byte_width) {
+		unode = (*urb_ptr)->context;
+		if (((unode->codec != batch_codec) ||
+		     (byte_offset < unode->seg_end)) &&
+		    dlfb_end_batch(dev, urb_ptr, urb_buf_ptr, sent_ptr))
+			return 1;
+	}
+
+	while (byte_width) {
+		cycles_t start_cycles = get_cycles();
+		char *cmd, *cmd_end;
+		u32 len;
+
+		if (!*urb_ptr &&
+		    dlfb_start_batch(dev, urb_ptr, urb_buf_ptr, batch_codec))
+			return 1;
+
+		unode = (*urb_ptr)->context;
+		cmd = *urb_buf_ptr;
+		cmd_end = dlfb_batch_end(dev, *urb_ptr);
+
+		/* not worth starting a segment in the last few bytes */
+		if (cmd_end - cmd < SEGMENT_HEADER_BYTES + MIN_SEGMENT_BYTES) {
+			if (dlfb_end_batch(dev, urb_ptr, urb_buf_ptr, sent_ptr))
+				return 1;
+			continue;
+		}
+
+		cmd = dlfb_put_varint(cmd, (byte_offset - unode->seg_end) / BPP);
+		if (batch_codec == DLFB_CODEC_AUTO)
+			*cmd++ = codec;
+		cmd = dlfb_encode_segment(dev, cmd, cmd_end, line_start,
+					  byte_offset, byte_width, trim, codec,
+					  dev->video.delta_buf, &len);
+
+		if (stat) {
+			stat->in += len;
+			stat->out += cmd - *urb_buf_ptr;
+			stat->cycles += get_cycles() - start_cycles;
+		}
+
+		dlfb_urb_carries_span(dev, *urb_ptr, byte_offset, len);
+		unode->seg_end = byte_offset + len;
+		*urb_buf_ptr = cmd;
+
+		line_start += len;
+		byte_offset += len;
+		byte_width -= len;
+	}
+
+	return 0;
+}
+
+/*
+ * Queue urb as one transfer made of a command header followed by len
+ * bytes of vmalloc memory, described page by page so nothing is copied.
+ * len must be at most DL_SG_MAX_BYTES.
+ */
+static int dlfb_submit_sg(struct dlfb_data *dev, struct urb *urb,
+			  const char *header, int header_len,
+			  const u8 *src, u32 len)
+{
+	struct urb_node *unode = urb->context;
+	const u32 total = header_len + len;
+	int n = 1;
+
+	memcpy(unode->sg_header, header, header_len);
+	sg_init_table(unode->sg, DL_SG_ENTRIES);
+	sg_set_buf(&unode->sg[0], unode->sg_header, header_len);
+
+	while (len) {
+		const u32 page_offset = offset_in_page(src);
+		const u32 chunk = min_t(u32, len, PAGE_SIZE - page_offset);
+
+		sg_set_page(&unode->sg[n++], vmalloc_to_page(src), chunk,
+			    page_offset);
+		src += chunk;
+		len -= chunk;
+	}
+	sg_mark_end(&unode->sg[n - 1]);
+
+	/* the hcd maps the list; completion goes back to the urb buffer */
+	urb->sg = unode->sg;
+	urb->num_sgs = n;
+	urb->transfer_flags &= ~URB_NO_TRANSFER_DMA_MAP;
+
+	return dlfb_submit_urb(dev, urb, total);
+}
+
+/*
+ * Send whole lines [y, y + height) of a framebuffer whose lines are
+ * contiguous, as large scatter-gather transfers.
+ *
+ * With a shadow buffer, the changed part is copied into the shadow and
+ * sent from there. That way the shadow always holds what was queued, and
+ * anything that overwrites it while a transfer is in flight is queued
+ * again behind it. Without a shadow, the framebuffer pages are sent as
+ * they are. Writes to them during a transfer are damage, and get sent
+ * again anyway. Updates smaller than an urb aren't worth mapping, so
+ * they take the copying path.
+ */
+static int dlfb_render_lines_sg(struct dlfb_data *dev, struct urb **urb_ptr,
+				char **urb_buf_ptr, int y, int height,
+				bool trim, int *ident_ptr, int *sent_ptr)
+{
+	struct fb_info *info = dev->video.info;
+	const u8 *front = (const u8 *) info->fix.smem_start;
+	u8 *back = (u8 *) dev->video.backing_buffer;
+	const u32 line_length = info->fix.line_length;
+	u32 byte_offset = line_length * y;
+	u32 byte_len = line_length * height;
+	char header[DL_SG_HEADER_MAX];
+
+	if (!batch) {
+		int x = 0, width = info->var.xres;
+
+		if (back && trim)
+			*ident_ptr += dlfb_trim_rect(dev, &x, &y,
+						     &width, &height);
+		if ((width != info->var.xres) ||
+		    (line_length * height < dev->video.urbs.size) ||
+		    (line_length > DL_SG_MAX_BYTES))
+			return dlfb_render_rect(dev, x, y, width, height,
+						trim, ident_ptr, sent_ptr);
+
+		byte_offset = line_length * y;
+		byte_len = line_length * height;
+	} else {
+		if (back && trim && IS_ALIGNED(byte_offset | byte_len,
+					       sizeof(unsigned long))) {
+			const u8 *changed = front + byte_offset;
+			int changed_len = byte_len;
+
+			*ident_ptr += dlfb_trim_hline(back + byte_offset,
+						      &changed, &changed_len);
+			byte_offset = changed - front;
+			byte_len = changed_len;
+		}
+		if (byte_len < dev->video.urbs.size)
+			return dlfb_render_hline(dev, urb_ptr,
+						 (const char *) front,
+						 urb_buf_ptr, byte_offset,
+						 byte_len, trim,
+						 DLFB_CODEC_NONE, NULL,
+						 ident_ptr, sent_ptr);
+	}
+
+	while (byte_len) {
+		u32 len = min_t(u32, byte_len, DL_SG_MAX_BYTES);
+		char *cmd = header;
+		struct urb *urb;
+
+		if (batch) {
+			/* one segment, so skip is the absolute offset */
+			*cmd++ = DLFB_OP_BATCH;
+			cmd = dlfb_put_varint(cmd, byte_offset / BPP);
+			cmd = dlfb_put_varint(cmd, len / BPP);
+		} else {
+			len = rounddown(len, line_length);
+			cmd = dlfb_rect_header(cmd, 0, byte_offset / line_length,
+					       info->var.xres,
+					       len / line_length);
+		}
+
+		/* the shadow only takes what is sure to be queued */
+		urb = dlfb_try_get_urb(dev);
+		if (!urb)
+			return 1;
+
+		if (back)
+			memcpy(back + byte_offset, front + byte_offset, len);
+
+		dlfb_urb_carries_span(dev, urb, byte_offset, len);
+		if (dlfb_submit_sg(dev, urb, header, cmd - header,
+				   (back ? back : front) + byte_offset, len))
+			return 1;
+
+		*sent_ptr += cmd - header + len;
+		byte_offset += len;
+		byte_len -= len;
+	}
+
+	return 0;
+}
+
+/* The codec a tile is sent with this flush */
+static int dlfb_tile_codec(const struct dlfb_tile_stat *st)
+{
+	return (st->trying < DL_TILE_CODECS) ? st->trying : st->codec;
+}
+
+/*
+ * End of the span of dirty tiles from tile that are sent alike, and
+ * their codec: the whole run, or in mixed batches the tiles in it that
+ * use the same one this flush.
+ */
+static int dlfb_span_end(struct beaglevideo *video, int tile, int row_end,
+			 int *codec)
+{
+	const int run_end = find_next_zero_bit(video->flush_tiles, row_end,
+					       tile);
+	int end;
+
+	if (!dlfb_mixed(video)) {
+		*codec = video->codec;
+		return run_end;
+	}
+
+	*codec = video->tile_stats[tile].now;
+	for (end = tile + 1; end < run_end; end++) {
+		if (video->tile_stats[end].now != *codec)
+			break;
+	}
+	return end;
+}
+
+static void dlfb_init_tile_stats(struct dlfb_tile_stat *stats, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		memset(&stats[i], 0, sizeof(stats[i]));
+		stats[i].stamp = jiffies;
+		stats[i].interval = MSEC_PER_SEC;
+		/* raw is known, a zero ratio gets the others tried first */
+		stats[i].ratio[DLFB_CODEC_NONE] = DL_RATIO_ONE;
+		stats[i].codec = DLFB_CODEC_RLE;
+		stats[i].trying = DL_TILE_CODECS;
+	}
+}
+
+/*
+ * Pick the codec for a tile's next update: the smallest recent ratio,
+ * or of two within DL_AUTO_SLACK the cheaper to encode. Tiles that
+ * change every frame or two without compressing well (video, mostly)
+ * go raw rather than burn cycles. Every DL_AUTO_TRY updates one of the
+ * others is tried for a flush, so what the choice is measured against
+ * stays current. Lossy is never chosen, see dlfb_tile_lossy().
+ */
+static void dlfb_auto_choose(struct beaglevideo *video,
+			     struct dlfb_tile_stat *st)
+{
+	const bool delta = video->backing_buffer;
+	int best = DLFB_CODEC_NONE;
+	int c;
+
+	st->trying = DL_TILE_CODECS;
+
+	for (c = DLFB_CODEC_NONE + 1; c < DL_TILE_CODECS; c++) {
+		if (((c == DLFB_CODEC_DELTA) && !delta) ||
+		    (c == DLFB_CODEC_LOSSY))
+			continue;
+		if ((st->ratio[c] + DL_AUTO_SLACK < st->ratio[best]) ||
+		    ((st->ratio[c] < st->ratio[best] + DL_AUTO_SLACK) &&
+		     (video->auto_cycles[c] < video->auto_cycles[best])))
+			best = c;
+	}
+
+	if ((st->interval < DL_AUTO_HOT_MS) &&
+	    (st->ratio[best] > DL_AUTO_HOT_RATIO))
+		best = DLFB_CODEC_NONE;
+
+	if (best != st->codec) {
+		st->codec = best;
+		st->uses = 0;
+	} else if (++st->uses >= DL_AUTO_TRY) {
+		st->uses = 0;
+		do {
+			st->trying = (best + 1 + st->tries++ %
+				      (DL_TILE_CODECS - 1)) % DL_TILE_CODECS;
+		} while (((st->trying == DLFB_CODEC_DELTA) && !delta) ||
+			 (st->trying == DLFB_CODEC_LOSSY));
+	}
+}
+
+/*
+ * Feed what a span of tiles came to with codec back into the auto
+ * codec: the span's ratio and cycles go to every tile in it, along
+ * with how long since each was last updated, and each chooses again.
+ * The running totals are in the first tile of the span.
+ */
+static void dlfb_auto_account(struct beaglevideo *video, int tile, int end,
+			      int codec)
+{
+	struct dlfb_tile_stat *span = &video->tile_stats[tile];
+	const unsigned long now = jiffies;
+	u32 ratio, cycles;
+
+	/* all of it was trimmed away */
+	if (!span->in)
+		return;
+
+	ratio = min_t(u32, span->out * DL_RATIO_ONE / span->in,
+		      2 * DL_RATIO_ONE);
+	cycles = span->cycles / DIV_ROUND_UP(span->in, 1024);
+	video->auto_cycles[codec] = video->auto_cycles[codec] -
+		video->auto_cycles[codec] / 8 + cycles / 8;
+	atomic_add(span->in, &video->codec_in[codec]);
+	atomic_add(span->out, &video->codec_out[codec]);
+
+	for (; tile < end; tile++) {
+		struct dlfb_tile_stat *st = &video->tile_stats[tile];
+		const u32 ms = min_t(u32, jiffies_to_msecs(now - st->stamp),
+				     USHRT_MAX);
+
+		st->interval = st->interval - st->interval / 8 + ms / 8;
+		st->stamp = now;
+		if (st->ratio[codec])
+			st->ratio[codec] = st->ratio[codec] -
+				st->ratio[codec] / 4 + ratio / 4;
+		else
+			st->ratio[codec] = max_t(u32, ratio, 1);
+		dlfb_auto_choose(video, st);
+	}
+}
+
+/*
+ * Whether a tile goes at reduced depth this flush: the link is over
+ * bandwidth_target and the tile is both hot and still changing. A tile
+ * that was quiet for DL_LOSSY_SETTLE_MS goes lossless, which is how
+ * dlfb_settle_lossy() gets lossy tiles repaired.
+ */
+static bool dlfb_tile_lossy(struct beaglevideo *video,
+			    const struct dlfb_tile_stat *st)
+{
+	return video->lossy_depth && (video->codec == DLFB_CODEC_AUTO) &&
+		(st->interval < DL_AUTO_HOT_MS) &&
+		time_before(jiffies, st->stamp +
+			    msecs_to_jiffies(DL_LOSSY_SETTLE_MS));
+}
+
+/*
+ * Depth a tile goes at this flush, or 0 for exact. A refinement flush
+ * takes each tile a step up from what the sink has, RGB332 to RGB444
+ * to exact. A coarse one, for damage over DL_PROGRESSIVE_PERCENT of
+ * the screen, sends it all at RGB332 to be refined while the link is
+ * idle. Otherwise only hot tiles over the bandwidth target are lossy.
+ * Whichever applies, lossy tiles of a flush share flush_depth.
+ */
+static int dlfb_tile_depth(struct beaglevideo *video,
+			   const struct dlfb_tile_stat *st)
+{
+	if (video->refining)
+		return (st->depth == LOSSY_RGB332) ? LOSSY_RGB444 : 0;
+	if (video->coarse)
+		return LOSSY_RGB332;
+	return dlfb_tile_lossy(video, st) ? video->lossy_depth : 0;
+}
+
+/*
+ * Settle the codec of every dirty tile of a tile row for this flush,
+ * before any of it is sent. Palette tiles are trimmed to the part that
+ * changed and their colours counted; with too many, or a block that
+ * wouldn't fit a transfer, they go as RLE rows instead.
+ */
+static void dlfb_plan_tile_row(struct dlfb_data *dev, int tile, int row_end,
+			       int *ident_ptr)
+{
+	struct beaglevideo *video = &dev->video;
+	struct fb_info *info = video->info;
+	const int shift = video->tile_shift;
+	const int row_start = row_end - video->tiles_x;
+	const int tile_y = (row_start / video->tiles_x) << shift;
+	int t;
+
+	for (t = tile; t < row_end;
+	     t = find_next_bit(video->flush_tiles, row_end, t + 1)) {
+		struct dlfb_tile_stat *st = &video->tile_stats[t];
+		u16 *palette = video->row_palettes +
+			(t - row_start) * DL_PALETTE_MAX;
+		const int tile_x = (t - row_start) << shift;
+		int x = tile_x, y = tile_y;
+		int width = min(x + (1 << shift), (int) info->var.xres) - x;
+		int height = min(y + (1 << shift), (int) info->var.yres) - y;
+		int ident = 0;
+		u32 size;
+
+		st->in = st->out = st->cycles = 0;
+		st->now = (video->codec == DLFB_CODEC_AUTO) ?
+			dlfb_tile_codec(st) : video->codec;
+		st->depth = dlfb_tile_depth(video, st);
+		if (st->depth) {
+			st->now = DLFB_CODEC_LOSSY;
+			__set_bit(t, video->lossy_tiles);
+			continue;
+		}
+		__clear_bit(t, video->lossy_tiles);
+		if (st->now != DLFB_CODEC_PALETTE)
+			continue;
+
+		if (video->backing_buffer && !test_bit(t, video->flush_resend))
+			ident = dlfb_trim_rect(dev, &x, &y, &width, &height);
+
+		st->rows = 0;
+		if (width && height) {
+			st->colours = dlfb_count_colours(
+				(const u8 *) info->fix.smem_start +
+				info->fix.line_length * y + x * BPP,
+				info->fix.line_length, width, height, palette);
+			size = PALETTE_HEADER_BYTES + st->colours * BPP +
+				DIV_ROUND_UP(width * height *
+					     dlfb_palette_bits(st->colours), 8);
+			if (!st->colours ||
+			    (size > video->urbs.size - COMPRESSED_HEADER_BYTES -
+			     2)) {
+				/* not worth picking again until it's tried */
+				st->ratio[DLFB_CODEC_PALETTE] = 2 * DL_RATIO_ONE;
+				st->now = DLFB_CODEC_RLE;
+				continue;
+			}
+			st->top = y - tile_y;
+			st->left = x - tile_x;
+			st->rows = height;
+			st->cols = width;
+		}
+		*ident_ptr += ident;
+	}
+}
+
+/*
+ * Send the changed block of a palette tile as one segment: its width
+ * and height, the palette, then an index for every pixel, row after
+ * row, packed high bits first. Pixels are matched against the palette
+ * counted when the row was planned. One drawn since in a new colour is
+ * sent as index 0, and the shadow takes what was sent, so the damage
+ * that comes with the drawing puts it right.
+ */
+static int dlfb_render_palette(struct dlfb_data *dev, struct urb **urb_ptr,
+			       char **urb_buf_ptr, int tile,
+			       struct dlfb_tile_stat *stat, int *sent_ptr)
+{
+	struct beaglevideo *video = &dev->video;
+	struct fb_info *info = video->info;
+	const struct dlfb_tile_stat *st = &video->tile_stats[tile];
+	const u16 *palette = video->row_palettes +
+		(tile % video->tiles_x) * DL_PALETTE_MAX;
+	const int shift = video->tile_shift;
+	const int x = ((tile % video->tiles_x) << shift) + st->left;
+	const int y = ((tile / video->tiles_x) << shift) + st->top;
+	const u32 line_length = info->fix.line_length;
+	const u32 byte_offset = line_length * y + x * BPP;
+	const int bits = dlfb_palette_bits(st->colours);
+	const int size = PALETTE_HEADER_BYTES + st->colours * BPP +
+		DIV_ROUND_UP(st->cols * st->rows * bits, 8);
+	const u8 *front = (const u8 *) info->fix.smem_start;
+	u8 *back = (u8 *) video->backing_buffer;
+	cycles_t start_cycles = get_cycles();
+	struct urb_node *unode;
+	char *cmd, *start;
+
+	if (*urb_ptr) {
+		unode = (*urb_ptr)->context;
+		if (((byte_offset < unode->seg_end) ||
+		     (dlfb_batch_end(dev, *urb_ptr) - *urb_buf_ptr < size)) &&
+		    dlfb_end_batch(dev, urb_ptr, urb_buf_ptr, sent_ptr))
+			return 1;
+	}
+
+	if (!*urb_ptr &&
+	    dlfb_start_batch(dev, urb_ptr, urb_buf_ptr, DLFB_CODEC_AUTO))
+		return 1;
+
+	unode = (*urb_ptr)->context;
+	start = cmd = *urb_buf_ptr;
+	cmd = dlfb_put_varint(cmd, (byte_offset - unode->seg_end) / BPP);
+	*cmd++ = DLFB_CODEC_PALETTE;
+	*cmd++ = st->cols;
+	*cmd++ = st->rows;
+	*cmd++ = st->colours - 1;
+	memcpy(cmd, palette, st->colours * BPP);
+	cmd += st->colours * BPP;
+	cmd = dlfb_palette_encode(cmd, front + byte_offset,
+				  back ? back + byte_offset : NULL,
+				  line_length, st->cols, st->rows,
+				  palette, st->colours);
+
+	if (stat) {
+		stat->in += st->cols * st->rows * BPP;
+		stat->out += cmd - start;
+		stat->cycles += get_cycles() - start_cycles;
+	}
+
+	dlfb_urb_carries(*urb_ptr, x, y, st->cols, st->rows);
+	/* later segments carry on from the end of its first row */
+	unode->seg_end = byte_offset + st->cols * BPP;
+	*urb_buf_ptr = cmd;
+	return 0;
+}
+
+/*
+ * Send the dirty tiles of a tile row, from tile up to row_end, into
+ * batches a row of pixels at a time across all of them, so segment
+ * offsets only grow within a transfer. Each span of tiles sent alike
+ * is a segment per row, except palette tiles, which go whole when the
+ * first row of their changed block comes. With the auto codec what the
+ * spans came to is then fed back into their tiles.
+ */
+static int dlfb_render_tile_row(struct dlfb_data *dev, struct urb **urb_ptr,
+				char **urb_buf_ptr, int tile, int row_end,
+				int *ident_ptr, int *sent_ptr)
+{
+	struct beaglevideo *video = &dev->video;
+	struct fb_info *info = video->info;
+	const int shift = video->tile_shift;
+	const int row_start = row_end - video->tiles_x;
+	const int y = (row_start / video->tiles_x) << shift;
+	const int height = min(y + (1 << shift), (int) info->var.yres) - y;
+	const bool stats = (video->codec == DLFB_CODEC_AUTO);
+	int span, span_end, codec, row, t;
+	bool trim;
+
+	if (dlfb_mixed(video))
+		dlfb_plan_tile_row(dev, tile, row_end, ident_ptr);
+
+	for (row = y; row < y + height; row++) {
+		for (span = tile; span < row_end;
+		     span = find_next_bit(video->flush_tiles, row_end,
+					  span_end)) {
+			const int x = (span - row_start) << shift;
+			struct dlfb_tile_stat *stat = stats ?
+				&video->tile_stats[span] : NULL;
+			int width;
+
+			span_end = dlfb_span_end(video, span, row_end, &codec);
+
+			if (codec == DLFB_CODEC_PALETTE) {
+				for (t = span; t < span_end; t++) {
+					const struct dlfb_tile_stat *st =
+						&video->tile_stats[t];
+
+					if (st->rows && (row == y + st->top) &&
+					    dlfb_render_palette(dev, urb_ptr,
+								urb_buf_ptr, t,
+								stat, sent_ptr))
+						return 1;
+				}
+				continue;
+			}
+
+			trim = find_next_bit(video->flush_resend, span_end,
+					     span) >= span_end;
+			width = min((span_end - row_start) << shift,
+				    (int) info->var.xres) - x;
+
+			if (dlfb_render_hline(dev, urb_ptr,
+					      (char *) info->fix.smem_start,
+					      urb_buf_ptr,
+					      info->fix.line_length * row +
+					      x * BPP, width * BPP, trim,
+					      dlfb_segment_codec(dev, codec,
+								 trim),
+					      stat, ident_ptr, sent_ptr))
+				return 1;
+		}
+	}
+
+	if (!stats)
+		return 0;
+
+	for (span = tile; span < row_end;
+	     span = find_next_bit(video->flush_tiles, row_end, span_end)) {
+		span_end = dlfb_span_end(video, span, row_end, &codec);
+		trim = find_next_bit(video->flush_resend, span_end, span) >=
+			span_end;
+		dlfb_auto_account(video, span, span_end,
+				  dlfb_segment_codec(dev, codec, trim));
+	}
+
+	return 0;
+}
+
+/*
+ * Room a band needs per tile row: every pixel raw, plus what RLE adds
+ * at worst, plus the header of each segment. A row of pixels has at
+ * most a span per dirty tile, each cut at DL_BAND_SEG_PIXELS.
+ */
+static u32 dlfb_band_row_bytes(struct beaglevideo *video)
+{
+	const u32 xres = video->info->var.xres;
+	const u32 segs = video->tiles_x + xres / DL_BAND_SEG_PIXELS + 1;
+
+	return (xres * BPP + xres / RLE_MAX_COUNT +
+		segs * (sizeof(struct dlfb_band_seg) + SEGMENT_HEADER_BYTES +
+			4)) << video->tile_shift;
+}
+
+/* Next tile row from ty with a dirty tile, or tiles_y */
+static int dlfb_next_dirty_row(struct beaglevideo *video, int ty)
+{
+	const int tile_count = video->tiles_x * video->tiles_y;
+
+	return find_next_bit(video->flush_tiles, tile_count,
+			     ty * video->tiles_x) / video->tiles_x;
+}
+
+/*
+ * Segment buffers of the bands, allocated the first time a flush is
+ * banded and kept until the device goes. Called with render_lock held.
+ */
+static int dlfb_alloc_bands(struct beaglevideo *video)
+{
+	int i;
+
+	for (i = 0; i < video->encode_threads; i++) {
+		if (!video->bands[i].buf)
+			video->bands[i].buf = vmalloc(DL_BAND_BYTES +
+						      DL_DELTA_PIXELS * BPP);
+		if (!video->bands[i].buf)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Whether this flush is encoded in bands. That only pays for damage of
+ * DL_BAND_MIN_BYTES or more; below it waking the threads costs more
+ * than it saves. The auto and palette codecs stay serial, as they plan
+ * and account tile by tile, and so does LZ4, which compresses batches
+ * whole as they end.
+ */
+static bool dlfb_banded(struct dlfb_data *dev, int tile_count)
+{
+	struct beaglevideo *video = &dev->video;
+	const u32 tile_bytes = BPP << (2 * video->tile_shift);
+
+	if (!batch || !dlfb_encode_wq || (video->encode_threads < 2) ||
+	    video->refining)
+		return false;
+	if ((video->codec != DLFB_CODEC_RLE) &&
+	    (video->codec != DLFB_CODEC_DELTA) &&
+	    (video->codec != DLFB_CODEC_FILTER))
+		return false;
+	if (bitmap_weight(video->flush_tiles, tile_count) * tile_bytes <
+	    DL_BAND_MIN_BYTES)
+		return false;
+	if (dlfb_band_row_bytes(video) > DL_BAND_BYTES -
+	    sizeof(struct dlfb_band_seg) - DL_BAND_SEG_BYTES)
+		return false;
+	return !dlfb_alloc_bands(video);
+}
+
+/*
+ * Encode the dirty tiles of a band's tile rows into its buffer, as
+ * dlfb_render_tile_row() would into batches: a segment per span of
+ * tiles sent alike per row of pixels, split at DL_BAND_SEG_PIXELS. The
+ * shadow is brought up to date as it goes. Bands are whole tile rows,
+ * so no two touch the same pixels, and the up and copy filters only
+ * look above within a tile.
+ */
+static void dlfb_encode_band(struct work_struct *work)
+{
+	struct dlfb_band *band = container_of(work, struct dlfb_band, work);
+	struct dlfb_data *dev = band->dev;
+	struct beaglevideo *video = &dev->video;
+	struct fb_info *info = video->info;
+	const u8 *front = (const u8 *) info->fix.smem_start;
+	u16 *scratch = (u16 *) (band->buf + DL_BAND_BYTES);
+	const int shift = video->tile_shift;
+	const bool mixed = dlfb_mixed(video);
+	int ty, row, span, span_end, codec;
+
+	band->used = 0;
+	band->ident = 0;
+
+	for (ty = band->ty; ty < band->ty_end; ty++) {
+		const int row_start = ty * video->tiles_x;
+		const int row_end = row_start + video->tiles_x;
+		const int first = find_next_bit(video->flush_tiles, row_end,
+						row_start);
+		const int y = ty << shift;
+		const int height = min(y + (1 << shift),
+				       (int) info->var.yres) - y;
+
+		band->ty_done = ty;
+
+		for (row = y; row < y + height; row++) {
+			for (span = first; span < row_end;
+			     span = find_next_bit(video->flush_tiles, row_end,
+						  span_end)) {
+				const int x = (span - row_start) << shift;
+				u32 byte_offset = info->fix.line_length * row +
+					x * BPP;
+				const u8 *line_start = front + byte_offset;
+				u32 byte_width;
+				bool trim;
+
+				span_end = dlfb_span_end(video, span, row_end,
+							 &codec);
+				trim = find_next_bit(video->flush_resend,
+						     span_end, span) >= span_end;
+				codec = dlfb_segment_codec(dev, codec, trim);
+				byte_width = (min((span_end - row_start) <<
+						  shift, (int) info->var.xres) -
+					      x) * BPP;
+
+				if (video->backing_buffer && trim)
+					band->ident += dlfb_trim_span(dev,
+						&line_start, &byte_offset,
+						&byte_width);
+
+				while (byte_width) {
+					struct dlfb_band_seg *seg =
+						(void *) (band->buf +
+							  band->used);
+					char *cmd = seg->data;
+					u32 len;
+
+					/* dlfb_band_row_bytes() leaves room */
+					if (WARN_ON_ONCE(band->used +
+							 sizeof(*seg) +
+							 DL_BAND_SEG_BYTES >
+							 DL_BAND_BYTES))
+						return;
+
+					if (mixed)
+						*cmd++ = codec;
+					cmd = dlfb_encode_segment(dev, cmd,
+						seg->data + DL_BAND_SEG_BYTES,
+						line_start, byte_offset,
+						min_t(u32, byte_width,
+						      DL_BAND_SEG_PIXELS * BPP),
+						trim, codec, scratch, &len);
+
+					seg->byte_offset = byte_offset;
+					seg->len = len;
+					seg->bytes = cmd - seg->data;
+					seg->codec = mixed ?
+						DLFB_CODEC_AUTO : codec;
+					band->used += ALIGN(sizeof(*seg) +
+							    seg->bytes, 4);
+
+					line_start += len;
+					byte_offset += len;
+					byte_width -= len;
+				}
+			}
+		}
+	}
+
+	band->ty_done = band->ty_end;
+}
+
+/*
+ * Put one encoded segment into the current batch, ending it first if
+ * the segment is of another kind, goes back, or doesn't fit.
+ */
+static int dlfb_place_segment(struct dlfb_data *dev, struct urb **urb_ptr,
+			      char **urb_buf_ptr,
+			      const struct dlfb_band_seg *seg, int *sent_ptr)
+{
+	struct urb_node *unode;
+	char *cmd;
+
+	if (*urb_ptr) {
+		unode = (*urb_ptr)->context;
+		if (((unode->codec != seg->codec) ||
+		     (seg->byte_offset < unode->seg_end) ||
+		     (dlfb_batch_end(dev, *urb_ptr) - *urb_buf_ptr <
+		      SEGMENT_HEADER_BYTES + seg->bytes)) &&
+		    dlfb_end_batch(dev, urb_ptr, urb_buf_ptr, sent_ptr))
+			return 1;
+	}
+
+	if (!*urb_ptr &&
+	    dlfb_start_batch(dev, urb_ptr, urb_buf_ptr, seg->codec))
+		return 1;
+
+	unode = (*urb_ptr)->context;
+	cmd = dlfb_put_varint(*urb_buf_ptr,
+			      (seg->byte_offset - unode->seg_end) / BPP);
+	memcpy(cmd, seg->data, seg->bytes);
+	*urb_buf_ptr = cmd + seg->bytes;
+
+	dlfb_urb_carries_span(dev, *urb_ptr, seg->byte_offset, seg->len);
+	unode->seg_end = seg->byte_offset + seg->len;
+	return 0;
+}
+
+/*
+ * Send all the dirty tiles of a flush, encoded in bands on the encode
+ * threads. Each round splits the dirty tile rows left evenly between
+ * the threads, as far as their buffers go; the first band is encoded
+ * here while the others run, then the segments are put into batches in
+ * band order, so skips still only grow within a transfer.
+ *
+ * The shadow is updated as bands are encoded, before anything is sent.
+ * If a batch can't be sent, the tiles of the round from *resume on are
+ * marked for resending, which goes untrimmed and never as a delta.
+ */
+static int dlfb_render_bands(struct dlfb_data *dev, struct urb **urb_ptr,
+			     char **urb_buf_ptr, int *resume,
+			     int *ident_ptr, int *sent_ptr)
+{
+	struct beaglevideo *video = &dev->video;
+	const u32 line_length = video->info->fix.line_length;
+	const int shift = video->tile_shift;
+	const int rows_max = (DL_BAND_BYTES - sizeof(struct dlfb_band_seg) -
+			      DL_BAND_SEG_BYTES) / dlfb_band_row_bytes(video);
+	int ty, dirty, per, n, i, t, end;
+
+	/* the threads only read the plan */
+	for (ty = dlfb_next_dirty_row(video, 0);
+	     dlfb_mixed(video) && (ty < video->tiles_y);
+	     ty = dlfb_next_dirty_row(video, ty + 1)) {
+		end = (ty + 1) * video->tiles_x;
+		dlfb_plan_tile_row(dev, find_next_bit(video->flush_tiles, end,
+						      end - video->tiles_x),
+				   end, ident_ptr);
+	}
+
+	ty = dlfb_next_dirty_row(video, 0);
+	while (ty < video->tiles_y) {
+		dirty = 0;
+		for (t = ty; t < video->tiles_y;
+		     t = dlfb_next_dirty_row(video, t + 1))
+			dirty++;
+		per = min(DIV_ROUND_UP(dirty, video->encode_threads),
+			  rows_max);
+
+		for (n = 0; (n < video->encode_threads) &&
+		     (ty < video->tiles_y); n++) {
+			video->bands[n].ty = ty;
+			for (i = 0; (i < per) && (ty < video->tiles_y); i++)
+				ty = dlfb_next_dirty_row(video, ty + 1);
+			video->bands[n].ty_end = ty;
+		}
+
+		for (i = 1; i < n; i++)
+			queue_work(dlfb_encode_wq, &video->bands[i].work);
+		dlfb_encode_band(&video->bands[0].work);
+		for (i = 1; i < n; i++)
+			flush_work(&video->bands[i].work);
+
+		for (i = 0; i < n; i++)
+			*ident_ptr += video->bands[i].ident;
+
+		for (i = 0; i < n; i++) {
+			struct dlfb_band *band = &video->bands[i];
+			const struct dlfb_band_seg *seg;
+			u32 pos;
+
+			*resume = band->ty * video->tiles_x;
+			for (pos = 0; pos < band->used;
+			     pos += ALIGN(sizeof(*seg) + seg->bytes, 4)) {
+				seg = (const void *) (band->buf + pos);
+				t = (seg->byte_offset / line_length) >> shift;
+				if (t >= band->ty_done)
+					break;
+				*resume = t * video->tiles_x;
+				if (dlfb_place_segment(dev, urb_ptr,
+						       urb_buf_ptr, seg,
+						       sent_ptr))
+					goto error;
+			}
+			if (band->ty_done < band->ty_end) {
+				*resume = band->ty_done * video->tiles_x;
+				goto error;
+			}
+		}
+	}
+
+	return 0;
+
+error:
+	end = ty * video->tiles_x;
+	for (t = find_next_bit(video->flush_tiles, end, *resume); t < end;
+	     t = find_next_bit(video->flush_tiles, end, t + 1))
+		__set_bit(t, video->flush_resend);
+	return 1;
+}
+
+/*
+ * Damage is tracked in a bitmap of square tiles, one bit per tile,
+ * row-major. Both damage paths (rectangles from the fb ops and ioctl,
+ * pages from fb_defio) only set bits here; dlfb_flush_damage() is the
+ * single place that turns dirty tiles into transfers.
+ * Tiles marked for resend were lost on the wire, so the shadow buffer
+ * no longer says what the sink shows: they are sent without trimming.
+ */
+static void dlfb_mark_damage(struct dlfb_data *dev, int x, int y,
+			     int width, int height, bool resend)
+{
+	struct beaglevideo *video = &dev->video;
+	const int shift = video->tile_shift;
+	int tx0, tx1, ty0, ty1, ty;
+	unsigned long flags;
+
+	if (x < 0) {
+		width += x;
+		x = 0;
+	}
+	if (y < 0) {
+		height += y;
+		y = 0;
+	}
+	if ((width <= 0) || (height <= 0))
+		return;
+
+	tx0 = x >> shift;
+	ty0 = y >> shift;
+	tx1 = min((x + width - 1) >> shift, video->tiles_x - 1);
+	ty1 = min((y + height - 1) >> shift, video->tiles_y - 1);
+
+	spin_lock_irqsave(&video->damage_lock, flags);
+	if (video->dirty_tiles && (tx0 <= tx1)) {
+		for (ty = ty0; ty <= ty1; ty++) {
+			bitmap_set(video->dirty_tiles,
+				   ty * video->tiles_x + tx0, tx1 - tx0 + 1);
+			if (resend)
+				bitmap_set(video->resend_tiles,
+					   ty * video->tiles_x + tx0,
+					   tx1 - tx0 + 1);
+		}
+	}
+	spin_unlock_irqrestore(&video->damage_lock, flags);
+}
+
+/*
+ * fb_defio reports whole pages. A page that stays within one scanline
+ * only dirties the tiles under its pixels; otherwise it covers every
+ * line it touches from edge to edge.
+ */
+static void dlfb_mark_page_damage(struct dlfb_data *dev, u32 byte_offset,
+				  u32 byte_len)
+{
+	const u32 line_length = dev->video.info->fix.line_length;
+	const u32 first_line = byte_offset / line_length;
+	const u32 last_line = (byte_offset + byte_len - 1) / line_length;
+
+	if (first_line == last_line) {
+		const int x = (byte_offset % line_length) / BPP;
+
+		dlfb_mark_damage(dev, x, first_line,
+				 DIV_ROUND_UP(byte_len, BPP), 1, false);
+	} else
+		dlfb_mark_damage(dev, 0, first_line, dev->video.info->var.xres,
+				 last_line - first_line + 1, false);
+}
+
+/*
+ * Lossy tiles that have stopped changing are marked dirty again, to go
+ * at full depth. The shadow holds what the sink was sent, so trimming
+ * leaves only the pixels the dither changed. Called with damage_lock
+ * held.
+ */
+static void dlfb_settle_lossy(struct beaglevideo *video, int tile_count)
+{
+	const unsigned long settle = msecs_to_jiffies(DL_LOSSY_SETTLE_MS);
+	const unsigned long now = jiffies;
+	int t;
+
+	for_each_set_bit(t, video->lossy_tiles, tile_count) {
+		if (time_before(now, video->tile_stats[t].stamp + settle))
+			continue;
+		__set_bit(t, video->dirty_tiles);
+		__clear_bit(t, video->lossy_tiles);
+	}
+}
+
+/*
+ * With nothing else to send and urbs to spare, pick up to
+ * DL_REFINE_TILES lossy tiles to go a step up this flush. Damage that
+ * comes in the meantime is sent first, and at whatever depth it calls
+ * for, so a refinement never goes out for pixels newer ones replaced.
+ * Called with damage_lock held. Returns whether any were picked.
+ */
+static bool dlfb_refine_lossy(struct beaglevideo *video, int tile_count)
+{
+	int t, picked = 0;
+
+	if (!video->progressive || atomic_read(&video->congested) ||
+	    !bitmap_empty(video->dirty_tiles, tile_count))
+		return false;
+
+	for_each_set_bit(t, video->lossy_tiles, tile_count) {
+		__set_bit(t, video->dirty_tiles);
+		if (++picked == DL_REFINE_TILES)
+			break;
+	}
+
+	return picked;
+}
+
+/*
+ * Measure the send rate over DL_LOSSY_WINDOW_MS and step the lossy
+ * depth: down to RGB444 then RGB332 while it is over bandwidth_target,
+ * back up once it is under half of it. The halving keeps a link that
+ * only fits lossy from flapping between the two.
+ */
+static void dlfb_lossy_update(struct beaglevideo *video, int bytes_sent)
+{
+	const unsigned long now = jiffies;
+	u32 rate;
+
+	video->rate_bytes += bytes_sent;
+	if (time_before(now, video->rate_stamp +
+			msecs_to_jiffies(DL_LOSSY_WINDOW_MS)))
+		return;
+
+	rate = div64_u64((u64) video->rate_bytes * MSEC_PER_SEC,
+		 jiffies_to_msecs(now - video->rate_stamp)) / 1024;
+	video->rate_stamp = now;
+	video->rate_bytes = 0;
+
+	if (!video->bandwidth_target)
+		video->lossy_depth = 0;
+	else if (rate > video->bandwidth_target)
+		video->lossy_depth = min(video->lossy_depth + 1, LOSSY_RGB332);
+	else if ((rate < video->bandwidth_target / 2) && video->lossy_depth)
+		video->lossy_depth--;
+}
+
+/*
+ * Send everything marked dirty since the last flush
+ */
+static int dlfb_flush_damage(struct dlfb_data *dev)
+{
+	struct beaglevideo *video = &dev->video;
+	struct fb_info *info = video->info;
+	const int tile_count = video->tiles_x * video->tiles_y;
+	const int shift = video->tile_shift;
+	int tile, run_end;
+	struct urb *urb = NULL;
+	char *cmd = NULL;
+	cycles_t start_cycles, end_cycles;
+	int bytes_sent = 0;
+	int bytes_identical = 0;
+	int bytes_rendered = 0;
+	unsigned long flags;
+	bool lines_sg, sg_trim = true, banded;
+	int sg_y = 0, sg_height = 0;
+	int resume = -1;
+	int batched_ty = -1;
+
+	if (!atomic_read(&video->usb_active))
+		return 0;
+
+	mutex_lock(&video->render_lock);
+
+	if (!video->dirty_tiles)
+		goto unlock;
+
+	start_cycles = get_cycles();
+
+	/* full width runs are contiguous when lines have no padding */
+	lines_sg = zero_copy && video->sg_capable &&
+		(video->codec == DLFB_CODEC_NONE) &&
+		(info->fix.line_length == info->var.xres * BPP);
+
+	spin_lock_irqsave(&video->damage_lock, flags);
+	/*
+	 * Big damage (a page switch, a window dragged) goes coarse first.
+	 * Only new damage counts, and settled tiles wait for the next
+	 * flush, as they must go exact.
+	 */
+	video->coarse = video->progressive &&
+		(video->codec == DLFB_CODEC_AUTO) &&
+		(bitmap_weight(video->dirty_tiles, tile_count) * 100 >=
+		 tile_count * DL_PROGRESSIVE_PERCENT);
+	video->refining = false;
+	if (!video->coarse) {
+		dlfb_settle_lossy(video, tile_count);
+		video->refining = dlfb_refine_lossy(video, tile_count);
+	}
+	bitmap_copy(video->flush_tiles, video->dirty_tiles, tile_count);
+	bitmap_zero(video->dirty_tiles, tile_count);
+	bitmap_copy(video->flush_resend, video->resend_tiles, tile_count);
+	bitmap_zero(video->resend_tiles, tile_count);
+	spin_unlock_irqrestore(&video->damage_lock, flags);
+
+	video->flush_depth = video->refining ? LOSSY_RGB444 :
+		video->coarse ? LOSSY_RGB332 : video->lossy_depth;
+	banded = dlfb_banded(dev, tile_count);
+
+	/* walk dirty tiles as horizontal runs within each row of tiles */
+	for (tile = find_first_bit(video->flush_tiles, tile_count);
+	     tile < tile_count;
+	     tile = find_next_bit(video->flush_tiles, tile_count, run_end)) {
+		const int ty = tile / video->tiles_x;
+		const int row_start = ty * video->tiles_x;
+		const int x = (tile - row_start) << shift;
+		const int y = ty << shift;
+		int width, height;
+		bool trim;
+
+		run_end = find_next_zero_bit(video->flush_tiles,
+					     row_start + video->tiles_x, tile);
+		trim = find_next_bit(video->flush_resend, run_end, tile) >=
+			run_end;
+		width = min((run_end - row_start) << shift,
+			    (int) info->var.xres) - x;
+		height = min(y + (1 << shift), (int) info->var.yres) - y;
+
+		bytes_rendered += width * height * BPP;
+
+		/* batched along with the first run of its tile row */
+		if (banded || (ty == batched_ty))
+			continue;
+
+		/* everything from here on is unsent if rendering fails */
+		resume = sg_height ? (sg_y >> shift) * video->tiles_x : tile;
+
+		/* gather consecutive full width tile rows into one span */
+		if (lines_sg && (width == info->var.xres)) {
+			if (sg_height && (y != sg_y + sg_height)) {
+				if (dlfb_render_lines_sg(dev, &urb, &cmd,
+							 sg_y, sg_height,
+							 sg_trim,
+							 &bytes_identical,
+							 &bytes_sent))
+					goto error;
+				sg_height = 0;
+				resume = tile;
+			}
+			if (!sg_height) {
+				sg_y = y;
+				sg_trim = true;
+			}
+			sg_height += height;
+			sg_trim &= trim;
+			continue;
+		}
+
+		if (!batch) {
+			if (dlfb_render_rect(dev, x, y, width, height, trim,
+					     &bytes_identical, &bytes_sent))
+				goto error;
+			continue;
+		}
+
+		batched_ty = ty;
+		if (dlfb_render_tile_row(dev, &urb, &cmd, tile,
+					 row_start + video->tiles_x,
+					 &bytes_identical, &bytes_sent))
+			goto error;
+	}
+
+	if (banded && dlfb_render_bands(dev, &urb, &cmd, &resume,
+					&bytes_identical, &bytes_sent))
+		goto error;
+
+	if (sg_height) {
+		resume = (sg_y >> shift) * video->tiles_x;
+		if (dlfb_render_lines_sg(dev, &urb, &cmd, sg_y, sg_height,
+					 sg_trim, &bytes_identical, &bytes_sent))
+			goto error;
+	}
+	resume = -1;
+
+error:
+	if (urb)
+		dlfb_end_batch(dev, &urb, &cmd, &bytes_sent);
+
+	/*
+	 * Out of urbs (or a submit failed): keep what wasn't queued dirty.
+	 * Later damage merges into it, and the framebuffer is read again
+	 * when it's sent, so only the newest pixels go out.
+	 */
+	if (resume >= 0) {
+		bitmap_clear(video->flush_tiles, 0, resume);
+		bitmap_clear(video->flush_resend, 0, resume);
+		spin_lock_irqsave(&video->damage_lock, flags);
+		bitmap_or(video->dirty_tiles, video->dirty_tiles,
+			  video->flush_tiles, tile_count);
+		bitmap_or(video->resend_tiles, video->resend_tiles,
+			  video->flush_resend, tile_count);
+		spin_unlock_irqrestore(&video->damage_lock, flags);
+	}
+
+	atomic_add(bytes_sent, &video->bytes_sent);
+	atomic_add(bytes_identical, &video->bytes_identical);
+	atomic_add(bytes_rendered, &video->bytes_rendered);
+	end_cycles = get_cycles();
+	atomic_add(((unsigned int) ((end_cycles - start_cycles)
+		    >> 10)), /* Kcycles */
+		   &video->cpu_kcycles_used);
+
+	dlfb_lossy_update(video, bytes_sent);
+	/* come back to refine lossy tiles, or once they may have settled */
+	if (!bitmap_empty(video->lossy_tiles, tile_count))
+		schedule_delayed_work(&video->damage_work, video->progressive ?
+				      DL_FRAME_INTERVAL :
+				      msecs_to_jiffies(DL_LOSSY_SETTLE_MS));
+
+unlock:
+	mutex_unlock(&video->render_lock);
+	return 0;
+}
+
+/*
+ * Sizes the urb pool from what the link has been doing. Bandwidth is
+ * measured over the time the bulk pipe was actually busy, so idle
+ * screens don't drag it down. Each urb carries about a millisecond of
+ * data, and enough of them are kept to cover the bandwidth-delay
+ * product plus the one being filled, so the pipe never runs dry while
+ * the next transfer is rendered. One more is added if the renderer had
+ * to wait for a free urb.
+ */
+static void dlfb_autotune_urbs(struct dlfb_data *dev)
+{
+	struct urb_list *urbs = &dev->video.urbs;
+	unsigned long flags;
+	u64 bytes, busy_us, bandwidth, in_flight;
+	u32 transfers, rtt_us;
+	int waits, count;
+	size_t size;
+
+	if (!urbs->autotune ||
+	    time_before(jiffies, urbs->autotune_stamp + DL_AUTOTUNE_INTERVAL))
+		return;
+	urbs->autotune_stamp = jiffies;
+
+	spin_lock_irqsave(&urbs->lock, flags);
+	bytes = urbs->stat_bytes;
+	busy_us = urbs->stat_busy_us;
+	transfers = urbs->stat_transfers;
+	rtt_us = urbs->stat_min_rtt_us;
+	urbs->stat_bytes = 0;
+	urbs->stat_busy_us = 0;
+	urbs->stat_transfers = 0;
+	urbs->stat_min_rtt_us = 0;
+	spin_unlock_irqrestore(&urbs->lock, flags);
+	waits = atomic_xchg(&urbs->waits, 0);
+
+	if ((transfers < DL_AUTOTUNE_SAMPLES) || !busy_us)
+		return;
+
+	bandwidth = div64_u64(bytes * USEC_PER_SEC, busy_us);
+	size = dlfb_transfer_size(dev, min_t(u64, bandwidth / MSEC_PER_SEC,
+					     DL_TRANSFER_MAX));
+	in_flight = div64_u64(bandwidth * rtt_us, USEC_PER_SEC);
+	count = DIV_ROUND_UP_ULL(in_flight, size) + 1 + (waits ? 1 : 0);
+	count = clamp(count, DL_URB_COUNT_MIN, DL_URB_COUNT_MAX);
+
+	/* only pay for a resize when capacity moves by more than a quarter */
+	if ((count * size * 4 > urbs->count * urbs->size * 3) &&
+	    (count * size * 4 < urbs->count * urbs->size * 5))
+		return;
+
+	pr_info("autotune: %llu B/s, rtt %u us, %d waits -> %d x %d byte urbs\n",
+		bandwidth, rtt_us, waits, count, (int) size);
+	dlfb_resize_urb_list(dev, count, size);
+}
+
+/*
+ * Runs once per frame interval while there is damage. Pending areas are
+ * marked into the tile bitmap alongside any defio pages and sent in one
+ * flush.
+ */
+static void dlfb_damage_work(struct work_struct *work)
+{
+	struct dlfb_data *dev = container_of(work, struct dlfb_data,
+					     video.damage_work.work);
+	struct dloarea areas[DL_DAMAGE_AREAS];
+	unsigned long flags;
+	int count, i;
+
+	/* disconnected: info may be going away, nothing to send it to */
+	if (!atomic_read(&dev->video.usb_active))
+		return;
+
+	spin_lock_irqsave(&dev->video.damage_lock, flags);
+	count = dev->video.damage_count;
+	memcpy(areas, dev->video.damage_areas, count * sizeof(areas[0]));
+	dev->video.damage_count = 0;
+	spin_unlock_irqrestore(&dev->video.damage_lock, flags);
+
+	for (i = 0; i < count; i++)
+		dlfb_mark_damage(dev, areas[i].x, areas[i].y,
+				 areas[i].w, areas[i].h, false);
+
+	/* something unknown was lost, only a full repaint is safe */
+	if (atomic_xchg(&dev->video.lost_pixels, 0))
+		dlfb_mark_damage(dev, 0, 0, dev->video.info->var.xres,
+				 dev->video.info->var.yres, true);
+
+	dlfb_flush_damage(dev);
+	dlfb_autotune_urbs(dev);
+}
+
+/*
+ * Records damage for the next frame tick. Never touches USB, so it is
+ * cheap enough to call for every glyph fbcon draws.
+ */
+int dlfb_handle_damage(struct dlfb_data *dev, int x, int y,
+	       int width, int height, char *data)
+{
+	struct dloarea area;
+	unsigned long flags;
+
+	if ((width <= 0) || (height <= 0) ||
+	    (x + width > dev->video.info->var.xres) ||
+	    (y + height > dev->video.info->var.yres))
+		return -EINVAL;
+
+	area.x = x;
+	area.y = y;
+	area.w = width;
+	area.h = height;
+	area.x2 = x + width;
+	area.y2 = y + height;
+
+	spin_lock_irqsave(&dev->video.damage_lock, flags);
+	dlfb_merge_area(dev->video.damage_areas, &dev->video.damage_count,
+			DL_DAMAGE_AREAS, area);
+	spin_unlock_irqrestore(&dev->video.damage_lock, flags);
+
+	schedule_delayed_work(&dev->video.damage_work, DL_FRAME_INTERVAL);
+
+	return 0;
+}
+
+static ssize_t dlfb_ops_read(struct fb_info *info, char __user *buf,
+			 size_t count, loff_t *ppos)
+{
+	ssize_t result = -ENOSYS;
+	
+	printk("dlfb_ops_read called\n");
+
+#if defined CONFIG_FB_SYS_FOPS
+	result = fb_sys_read(info, buf, count, ppos);
+#endif
+
+	return result;
+}
+
+/*
+ * Path triggered by usermode clients who write to filesystem
+ * e.g. cat filename > /dev/fb1
+ * Not used by X Windows or text-mode console. But useful for testing.
+ * Slow because of extra copy and we must assume all pixels dirty.
+ */
+static ssize_t dlfb_ops_write(struct fb_info *info, const char __user *buf,
+			  size_t count, loff_t *ppos)
+{
+	ssize_t result = -ENOSYS;
+	
+	printk("dlfb_ops_write called\n");
+
+#if defined CONFIG_FB_SYS_FOPS
+
+	struct dlfb_data *dev = info->par;
+	u32 offset = (u32) *ppos;
+
+	result = fb_sys_write(info, buf, count, ppos);
+
+	if (result > 0) {
+		int start = max((int)(offset / info->fix.line_length) - 1, 0);
+		int lines = min((u32)((result / info->fix.line_length) + 1),
+				(u32)info->var.yres);
+
+		dlfb_handle_damage(dev, 0, start, info->var.xres,
+			lines, info->screen_base);
+	}
+
+#endif
+	return result;
+}
+
+/* hardware has native COPY command (see libdlo), but not worth it for fbcon */
+static void dlfb_ops_copyarea(struct fb_info *info,
+				const struct fb_copyarea *area)
+{
+#if defined CONFIG_FB_SYS_COPYAREA
+
+	struct dlfb_data *dev = info->par;
+
+	sys_copyarea(info, area);
+
+	dlfb_handle_damage(dev, area->dx, area->dy,
+			area->width, area->height, info->screen_base);
+#endif
+
+}
+
+static void dlfb_ops_imageblit(struct fb_info *info,
+				const struct fb_image *image)
+{
+#if defined CONFIG_FB_SYS_IMAGEBLIT
+
+	struct dlfb_data *dev = info->par;
+
+	sys_imageblit(info, image);
+
+	dlfb_handle_damage(dev, image->dx, image->dy,
+			image->width, image->height, info->screen_base);
+
+#endif
+
+}
+
+static void dlfb_ops_fillrect(struct fb_info *info,
+			  const struct fb_fillrect *rect)
+{
+#if defined CONFIG_FB_SYS_FILLRECT
+
+	struct dlfb_data *dev = info->par;
+
+	sys_fillrect(info, rect);
+
+	dlfb_handle_damage(dev, rect->dx, rect->dy, rect->width,
+			      rect->height, info->screen_base);
+#endif
+
+}
+
+#ifdef CONFIG_FB_DEFERRED_IO
+/*
+ * NOTE: fb_defio.c is holding info->fbdefio.mutex
+ *   Touching ANY framebuffer memory that triggers a page fault
+ *   in fb_defio will cause a deadlock, when it also tries to
+ *   grab the same mutex.
+ */
+ 
+static void dlfb_dpy_deferred_io(struct fb_info *info,
+				struct list_head *pagelist)
+{
+	struct page *cur;
+	struct fb_deferred_io *fbdefio = info->fbdefio;
+	struct dlfb_data *dev = info->par;
+	
+	printk("A deferred io call occured\n");
+
+	if (!fb_defio)
+		return;
+
+	if (!atomic_read(&dev->video.usb_active))
+		return;
+
+	/* mark each written page; the damage worker sends them */
+	list_for_each_entry(cur, &fbdefio->pagelist, lru)
+		dlfb_mark_page_damage(dev, cur->index << PAGE_SHIFT,
+				      PAGE_SIZE);
+
+	schedule_delayed_work(&dev->video.damage_work, 0);
+}
+
+#endif
+
+static int dlfb_ops_ioctl(struct fb_info *info, unsigned int cmd,
+				unsigned long arg)
+{
+
+	struct dlfb_data *dev = info->par;
+	
+	printk("dlfb_ops_ioctl called\n");
+
+	if (!atomic_read(&dev->video.usb_active))
+		return 0;
+
+	/* TODO: Update X server to get this from sysfs instead */
+	if (cmd == DLFB_IOCTL_RETURN_EDID) {
+		void __user *edid = (void __user *)arg;
+		if (copy_to_user(edid, dev->video.edid, dev->video.edid_size))
+			return -EFAULT;
+		return 0;
+	}
+
+	/* TODO: Help propose a standard fb.h ioctl to report mmap damage */
+	if (cmd == DLFB_IOCTL_REPORT_DAMAGE) {
+		struct dloarea area;
+
+		if (copy_from_user(&area, (void __user *)arg,
+				  sizeof(struct dloarea)))
+			return -EFAULT;
+
+		/*
+		 * If we have a damage-aware client, turn fb_defio "off"
+		 * To avoid perf imact of unnecessary page fault handling.
+		 * Done by resetting the delay for this fb_info to a very
+		 * long period. Pages will become writable and stay that way.
+		 * Reset to normal value when all clients have closed this fb.
+		 */
+#ifdef CONFIG_FB_DEFERRED_IO
+		if (info->fbdefio)
+			info->fbdefio->delay = DL_DEFIO_WRITE_DISABLE;
+#endif
+		if (area.x < 0)
+			area.x = 0;
+
+		if (area.x > info->var.xres)
+			area.x = info->var.xres;
+
+		if (area.y < 0)
+			area.y = 0;
+
+		if (area.y > info->var.yres)
+			area.y = info->var.yres;
+
+		dlfb_handle_damage(dev, area.x, area.y, area.w, area.h,
+			   info->screen_base);
+	}
+
+	return 0;
+}
+
+/* taken from vesafb */
+static int
+dlfb_ops_setcolreg(unsigned regno, unsigned red, unsigned green,
+	       unsigned blue, unsigned transp, struct fb_info *info)
+{
+	int err = 0;
+
+	printk("dlfb_ops_setcolreg called\n");	
+	
+	if (regno >= info->cmap.len)
+		return 1;
+
+	if (regno < 16) {
+		if (info->var.red.offset == 10) {
+			/* 1:5:5:5 */
+			((u32 *) (info->pseudo_palette))[regno] =
+			    ((red & 0xf800) >> 1) |
+			    ((green & 0xf800) >> 6) | ((blue & 0xf800) >> 11);
+		} else {
+			/* 0:5:6:5 */
+			((u32 *) (info->pseudo_palette))[regno] =
+			    ((red & 0xf800)) |
+			    ((green & 0xfc00) >> 5) | ((blue & 0xf800) >> 11);
+		}
+	}
+
+	return err;
+}
+
+/*
+ * It's common for several clients to have framebuffer open simultaneously.
+ * e.g. both fbcon and X. Makes things interesting.
+ * Assumes caller is holding info->lock (for open and release at least)
+ */
+static int dlfb_ops_open(struct fb_info *info, int user)
+{
+	struct dlfb_data *dev = info->par;
+	
+	printk("dlfb_ops_open called\n");
+
+	/*
+	 * fbcon aggressively connects to first framebuffer it finds,
+	 * preventing other clients (X) from working properly. Usually
+	 * not what the user wants. Fail by default with option to enable.
+	 */
+	if ((user == 0) && (!console))
+		return -EBUSY;
+
+	/* If the USB device is gone, we don't accept new opens */
+	if (dev->video.virtualized)
+		return -ENODEV;
+
+	dev->video.fb_count++;
+
+	kref_get(&dev->kref);
+
+#ifdef CONFIG_FB_DEFERRED_IO
+	if (fb_defio && (info->fbdefio == NULL)) {
+		/* enable defio at last moment if not disabled by client */
+
+		struct fb_deferred_io *fbdefio;
+
+		fbdefio = kmalloc(sizeof(struct fb_deferred_io), GFP_KERNEL);
+
+		if (fbdefio) {
+			fbdefio->delay = DL_DEFIO_WRITE_DELAY;
+			fbdefio->deferred_io = dlfb_dpy_deferred_io;
+		}
+
+		info->fbdefio = fbdefio;
+		fb_deferred_io_init(info);
+	}
+#endif
+
+	pr_notice("open /dev/fb%d user=%d fb_info=%p count=%d\n",
+	    info->node, user, info, dev->video.fb_count);
+
+	return 0;
+}
+
+/*
+ * Called when all client interfaces to start transactions have been disabled,
+ * and all references to our device instance (dlfb_data) are released.
+ * Every transaction must have a reference, so we know are fully spun down
+ */
+static void dlfb_free(struct kref *kref)
+{
+	struct dlfb_data *dev = container_of(kref, struct dlfb_data, kref);
+	int i;
+	
+	printk("dlfb_free called\n");
+
+	cancel_delayed_work_sync(&dev->video.damage_work);
+
+	if (dev->video.backing_buffer)
+		vfree(dev->video.backing_buffer);
+
+	kfree(dev->video.dirty_tiles);
+	kfree(dev->video.flush_tiles);
+	kfree(dev->video.resend_tiles);
+	kfree(dev->video.flush_resend);
+	kfree(dev->video.lossy_tiles);
+	kfree(dev->video.delta_buf);
+	kfree(dev->video.tile_stats);
+	kfree(dev->video.row_palettes);
+	vfree(dev->video.lz4_buf);
+	vfree(dev->video.lz4_wrkmem);
+	vfree(dev->video.lz4_out);
+	vfree(dev->video.huff_buf);
+	kfree(dev->video.huff);
+	for (i = 0; i < DL_ENCODE_THREADS_MAX; i++)
+		vfree(dev->video.bands[i].buf);
+	kfree(dev->video.edid);
+
+	pr_warn("freeing dlfb_data %p\n", dev);
+
+	kfree(dev);
+}
+
+static void dlfb_release_urb_work(struct work_struct *work)
+{
+	struct urb_node *unode = container_of(work, struct urb_node,
+					      release_urb_work.work);
+					      
+	printk("dlfb_release_urb_work called\n");
+
+	dlfb_urb_returned(unode->dev);
+}
+
+static void dlfb_free_framebuffer(struct dlfb_data *dev)
+{
+	struct fb_info *info = dev->video.info;
+	
+	printk("dlfb_free_framebuffer called\n");
+
+	/* the damage worker renders from info, stop it first */
+	cancel_delayed_work_sync(&dev->video.damage_work);
+
+	if (info) {
+		int node = info->node;
+
+		unregister_framebuffer(info);
+
+		if (info->cmap.len != 0)
+			fb_dealloc_cmap(&info->cmap);
+		if (info->monspecs.modedb)
+			fb_destroy_modedb(info->monspecs.modedb);
+		if (info->screen_base)
+			vfree(info->screen_base);
+
+		fb_destroy_modelist(&info->modelist);
+
+		dev->video.info = NULL;
+
+		/* Assume info structure is freed after this point */
+		framebuffer_release(info);
+
+		pr_warn("fb_info for /dev/fb%d has been freed\n", node);
+	}
+
+	/* ref taken in probe() as part of registering framebfufer */
+	kref_put(&dev->kref, dlfb_free);
+}
+
+static void dlfb_free_framebuffer_work(struct work_struct *work)
+{
+	struct dlfb_data *dev = container_of(work, struct dlfb_data,
+					     free_framebuffer_work.work);
+					     
+	printk("dlfb_free_framebuffer_work called\n");
+	
+	dlfb_free_framebuffer(dev);
+}
+/*
+ * Assumes caller is holding info->lock mutex (for open and release at least)
+ */
+static int dlfb_ops_release(struct fb_info *info, int user)
+{
+	struct dlfb_data *dev = info->par;
+
+	printk("dlfb_ops_release called\n");	
+	
+	dev->video.fb_count--;
+
+	/* We can't free fb_info here - fbmem will touch it when we return */
+	if (dev->video.virtualized && (dev->video.fb_count == 0))
+		schedule_delayed_work(&dev->free_framebuffer_work, HZ);
+
+#ifdef CONFIG_FB_DEFERRED_IO
+	if ((dev->video.fb_count == 0) && (info->fbdefio)) {
+		fb_deferred_io_cleanup(info);
+		kfree(info->fbdefio);
+		info->fbdefio = NULL;
+		info->fbops->fb_mmap = dlfb_ops_mmap;
+	}
+#endif
+
+	pr_warn("released /dev/fb%d user=%d count=%d\n",
+		  info->node, user, dev->video.fb_count);
+
+	kref_put(&dev->kref, dlfb_free);
+
+	return 0;
+}
+
+/*
+ * Check whether a video mode is supported by the DisplayLink chip
+ * We start from monitor's modes, so don't need to filter that here
+ */
+static int dlfb_is_valid_mode(struct fb_videomode *mode,
+		struct fb_info *info)
+{
+	struct dlfb_data *dev = info->par;
+	
+	printk("dlfb_is_valid_mode called\n");
+
+	if (mode->xres * mode->yres > dev->video.sku_pixel_limit) {
+		pr_warn("%dx%d beyond chip capabilities\n",
+		       mode->xres, mode->yres);
+		return 0;
+	}
+
+	pr_info("%dx%d @ %d Hz valid mode\n", mode->xres, mode->yres,
+		mode->refresh);
+
+	return 1;
+}
+
+static void dlfb_var_color_format(struct fb_var_screeninfo *var)
+{
+	const struct fb_bitfield red = { 11, 5, 0 };
+	const struct fb_bitfield green = { 5, 6, 0 };
+	const struct fb_bitfield blue = { 0, 5, 0 };
+	
+	printk("dlfb_var_color_format called\n");
+
+	var->bits_per_pixel = 16;
+	var->red = red;
+	var->green = green;
+	var->blue = blue;
+}
+
+static int dlfb_ops_check_var(struct fb_var_screeninfo *var,
+				struct fb_info *info)
+{
+	struct fb_videomode mode;
+	
+	printk("dlfb_ops_check_var called\n");
+
+	/* TODO: support dynamically changing framebuffer size */
+	if ((var->xres * var->yres * 2) > info->fix.smem_len)
+		return -EINVAL;
+
+	/* set device-specific elements of var unrelated to mode */
+	dlfb_var_color_format(var);
+
+	fb_var_to_videomode(&mode, var);
+
+	if (!dlfb_is_valid_mode(&mode, info))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int dlfb_ops_set_par(struct fb_info *info)
+{
+	struct dlfb_data *dev = info->par;
+	int result;
+	u16 *pix_framebuffer;
+	int i;
+	
+	printk("dlfb_ops_set_par called\n");
+
+	pr_notice("set_par mode %dx%d\n", info->var.xres, info->var.yres);
+
+	result = dlfb_set_video_mode(dev, &info->var);
+
+	if ((result == 0) && (dev->video.fb_count == 0)) {
+
+		/* paint greenscreen */
+
+		pix_framebuffer = (u16 *) info->screen_base;
+		for (i = 0; i < info->fix.smem_len / 2; i++)
+			pix_framebuffer[i] = 0x37e6;
+
+		dlfb_handle_damage(dev, 0, 0, info->var.xres, info->var.yres,
+				   info->screen_base);
+	}
+	
+	printk("Painting green completed \n");
+
+	return result;
+}
+
+/* To fonzi the jukebox (e.g. make blanking changes take effect) */
+static char *dlfb_dummy_render(char *buf)
+{
+	
+	printk("dlfb_dummy_render called\n");	
+	
+	*buf++ = 0xAF;
+	*buf++ = 0x6A; /* copy */
+	*buf++ = 0x00; /* from address*/
+	*buf++ = 0x00;
+	*buf++ = 0x00;
+	*buf++ = 0x01; /* one pixel */
+	*buf++ = 0x00; /* to address */
+	*buf++ = 0x00;
+	*buf++ = 0x00;
+	return buf;
+}
+
+/*
+ * In order to come back from full DPMS off, we need to set the mode again
+ */
+static int dlfb_ops_blank(int blank_mode, struct fb_info *info)
+{
+	struct dlfb_data *dev = info->par;
+	char *bufptr;
+	struct urb *urb;
+	
+	printk("dlfb_ops_blank called\n");
+
+	pr_info("/dev/fb%d FB_BLANK mode %d --> %d\n",
+		info->node, dev->video.blank_mode, blank_mode);
+
+	if ((dev->video.blank_mode == FB_BLANK_POWERDOWN) &&
+	    (blank_mode != FB_BLANK_POWERDOWN)) {
+
+		/* returning from powerdown requires a fresh modeset */
+		dlfb_set_video_mode(dev, &info->var);
+	}
+
+	urb = dlfb_get_urb(dev);
+	if (!urb)
+		return 0;
+
+	bufptr = (char *) urb->transfer_buffer;
+	bufptr = dlfb_vidreg_lock(bufptr);
+	bufptr = dlfb_blanking(bufptr, blank_mode);
+	bufptr = dlfb_vidreg_unlock(bufptr);
+
+	/* seems like a render op is needed to have blank change take effect */
+	bufptr = dlfb_dummy_render(bufptr);
+
+	/* see dlfb_set_video_mode: sink takes frame data only */
+	dlfb_release_urb(dev, urb);
+
+	dev->video.blank_mode = blank_mode;
+
+	return 0;
+}
+
+static struct fb_ops dlfb_ops = {
+	.owner = THIS_MODULE,
+	.fb_read = dlfb_ops_read,
+	.fb_write = dlfb_ops_write,
+	.fb_setcolreg = dlfb_ops_setcolreg,
+	.fb_fillrect = dlfb_ops_fillrect,
+	.fb_copyarea = dlfb_ops_copyarea,
+	.fb_imageblit = dlfb_ops_imageblit,
+	.fb_mmap = dlfb_ops_mmap,
+	.fb_ioctl = dlfb_ops_ioctl,
+	.fb_open = dlfb_ops_open,
+	.fb_release = dlfb_ops_release,
+	.fb_blank = dlfb_ops_blank,
+	.fb_check_var = dlfb_ops_check_var,
+	.fb_set_par = dlfb_ops_set_par,
+};
+
+
+/*
+ * Assumes &info->lock held by caller
+ * Assumes no active clients have framebuffer open
+ */
+static int dlfb_realloc_framebuffer(struct dlfb_data *dev, struct fb_info *info)
+{
+	int retval = -ENOMEM;
+	int old_len = info->fix.smem_len;
+	int new_len;
+	unsigned char *old_fb = info->screen_base;
+	unsigned char *new_fb;
+	unsigned char *new_back = 0;
+	bool held;
+	
+	printk("dlfb_realloc_framebuffer called\n");
+
+	pr_warn("Reallocating framebuffer. Addresses will change!\n");
+
+	new_len = info->fix.line_length * info->var.yres;
+
+	if (PAGE_ALIGN(new_len) > old_len) {
+		/*
+		 * Alloc system memory for virtual framebuffer
+		 */
+		new_fb = vmalloc(new_len);
+		if (!new_fb) {
+			pr_err("Virtual framebuffer alloc failed\n");
+			goto error;
+		}
+
+		/* zero-copy urbs in flight may still read the old buffers */
+		mutex_lock(&dev->video.render_lock);
+		held = !dlfb_hold_urbs(dev);
+
+		if (info->screen_base) {
+			memcpy(new_fb, old_fb, old_len);
+			vfree(info->screen_base);
+		}
+
+		info->screen_base = new_fb;
+		info->fix.smem_len = PAGE_ALIGN(new_len);
+		info->fix.smem_start = (unsigned long) new_fb;
+		info->flags = udlfb_info_flags;
+
+/*
+ * For a range of kernels, must set these to workaround bad logic
+ * that assumes all framebuffers are using PCI aperture.
+ * If we don't do this, when we call register_framebuffer, fbmem.c will
+ * forcibly unregister other framebuffers with smem_start of zero.  And
+ * that's most of them (VESA, EFI, etc).
+ */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 32) && \
+	LINUX_VERSION_CODE <= KERNEL_VERSION(2, 6, 34))
+		info->aperture_base = info->fix.smem_start;
+		info->aperture_size = info->fix.smem_len;
+#endif
+
+		/*
+		 * Second framebuffer copy to mirror the framebuffer state
+		 * on the physical USB device. We can function without this.
+		 * But with imperfect damage info we may send pixels over USB
+		 * that were, in fact, unchanged - wasting limited USB bandwidth
+		 */
+		if (shadow)
+			new_back = vzalloc(new_len);
+		if (!new_back)
+			pr_info("No shadow/backing buffer allocated\n");
+		/* an old, smaller shadow would be overrun, go without */
+		if (dev->video.backing_buffer)
+			vfree(dev->video.backing_buffer);
+		dev->video.backing_buffer = new_back;
+
+		if (held)
+			dlfb_unhold_urbs(dev);
+		mutex_unlock(&dev->video.render_lock);
+	}
+
+	retval = 0;
+
+error:
+	return retval;
+}
+
+/*
+ * (Re)size the damage tile bitmaps for the current mode.
+ * Assumes no flush is running concurrently or holds render_lock.
+ */
+static int dlfb_alloc_damage_tiles(struct dlfb_data *dev, struct fb_info *info)
+{
+	struct beaglevideo *video = &dev->video;
+	int size = tile_size;
+	int tiles_x, tiles_y;
+	unsigned long *dirty, *flush, *resend, *flush_resend, *lossy;
+	struct dlfb_tile_stat *stats;
+	u16 *palettes;
+	unsigned long flags;
+
+	if (!is_power_of_2(size) || (size < DL_TILE_SIZE_MIN) ||
+	    (size > DL_TILE_SIZE_MAX)) {
+		pr_warn("tile_size %d invalid, using %d\n", size, DL_TILE_SIZE);
+		size = DL_TILE_SIZE;
+	}
+
+	tiles_x = DIV_ROUND_UP(info->var.xres, size);
+	tiles_y = DIV_ROUND_UP(info->var.yres, size);
+
+	dirty = kzalloc(BITS_TO_LONGS(tiles_x * tiles_y) * sizeof(long),
+			GFP_KERNEL);
+	flush = kzalloc(BITS_TO_LONGS(tiles_x * tiles_y) * sizeof(long),
+			GFP_KERNEL);
+	resend = kzalloc(BITS_TO_LONGS(tiles_x * tiles_y) * sizeof(long),
+			 GFP_KERNEL);
+	flush_resend = kzalloc(BITS_TO_LONGS(tiles_x * tiles_y) * sizeof(long),
+			       GFP_KERNEL);
+	lossy = kzalloc(BITS_TO_LONGS(tiles_x * tiles_y) * sizeof(long),
+			GFP_KERNEL);
+	stats = kcalloc(tiles_x * tiles_y, sizeof(*stats), GFP_KERNEL);
+	palettes = kcalloc(tiles_x * DL_PALETTE_MAX, sizeof(u16), GFP_KERNEL);
+	if (!dirty || !flush || !resend || !flush_resend || !lossy || !stats ||
+	    !palettes) {
+		kfree(dirty);
+		kfree(flush);
+		kfree(resend);
+		kfree(flush_resend);
+		kfree(lossy);
+		kfree(stats);
+		kfree(palettes);
+		return -ENOMEM;
+	}
+	dlfb_init_tile_stats(stats, tiles_x * tiles_y);
+
+	mutex_lock(&video->render_lock);
+	spin_lock_irqsave(&video->damage_lock, flags);
+	swap(video->dirty_tiles, dirty);
+	swap(video->flush_tiles, flush);
+	swap(video->resend_tiles, resend);
+	swap(video->flush_resend, flush_resend);
+	swap(video->lossy_tiles, lossy);
+	swap(video->tile_stats, stats);
+	swap(video->row_palettes, palettes);
+	video->tile_shift = ilog2(size);
+	video->tiles_x = tiles_x;
+	video->tiles_y = tiles_y;
+	spin_unlock_irqrestore(&video->damage_lock, flags);
+	mutex_unlock(&video->render_lock);
+
+	kfree(dirty);
+	kfree(flush);
+	kfree(resend);
+	kfree(flush_resend);
+	kfree(lossy);
+	kfree(stats);
+	kfree(palettes);
+
+	pr_info("tracking damage in %dx%d tiles of %d pixels\n",
+		tiles_x, tiles_y, size);
+
+	return 0;
+}
+
+/*
+ * 1) Get EDID from hw, or use sw defaultstatic int dlfb_setup_modes
+ * 2) Parse into various fb_info structs
+ * 3) Allocate virtual framebuffer memory to back highest res mode
+ *
+ * Parses EDID into three places used by various parts of fbdev:
+ * fb_var_screeninfo contains the timing of the monitor's preferred mode
+ * fb_info.monspecs is full parsed EDID info, including monspecs.modedb
+ * fb_info.modelist is a linked list of all monitor & VESA modes which work
+ *
+ * If EDID is not readable/valid, then modelist is all VESA modes,
+ * monspecs is NULL, and fb_var_screeninfo is set to safe VESA mode
+ * Returns 0 if successful
+ */
+static int dlfb_setup_modes(struct dlfb_data *dev,
+			   struct fb_info *info,
+			   char *default_edid, size_t default_edid_size)
+{
+	int i, j;
+	const struct fb_videomode *default_vmode = NULL;
+	int result = 0;
+	char *edid = NULL;
+	int tries = 3;
+	
+	printk("dlfb_setup_modes called\n");
+
+	if (info->dev) /* only use mutex if info has been registered */
+		mutex_lock(&info->lock);
+
+	edid = kmalloc(EDID_LENGTH, GFP_KERNEL);
+	if (!edid) {
+		result = -ENOMEM;
+		goto error;
+	}
+	
+	for(j = 0; j < EDID_LENGTH; j++){
+		edid[j] = sony_sdmhs53_edid[j];
+	}
+
+	fb_destroy_modelist(&info->modelist);
+	memset(&info->monspecs, 0, sizeof(info->monspecs));
+
+	/*
+	 * Try to (re)read EDID from hardware first
+	 * EDID data may return, but not parse as valid
+	 * Try again a few times, in case of e.g. analog cable noise
+	 */
+	while (tries--) {
+
+		//i = dlfb_get_edid(dev, edid, EDID_LENGTH);
+		i = 128;
+		
+		if (i >= EDID_LENGTH){
+			fb_edid_to_monspecs(edid, &info->monspecs);
+		}
+
+		if (info->monspecs.modedb_len > 0) {
+			dev->video.edid = edid;
+			dev->video.edid_size = i;
+			break;
+		}
+	}
+
+	/* If that fails, use a previously returned EDID if available */
+	if (info->monspecs.modedb_len == 0) {
+
+		pr_err("Unable to get valid EDID from device/display\n");
+
+		if (dev->video.edid) {
+			fb_edid_to_monspecs(dev->video.edid, &info->monspecs);
+			if (info->monspecs.modedb_len > 0)
+				pr_err("Using previously queried EDID\n");
+		}
+	}
+
+	/* If that fails, use the default EDID we were handed */
+	if (info->monspecs.modedb_len == 0) {
+		if (default_edid_size >= EDID_LENGTH) {
+			fb_edid_to_monspecs(default_edid, &info->monspecs);
+			if (info->monspecs.modedb_len > 0) {
+				memcpy(edid, default_edid, default_edid_size);
+				dev->video.edid = edid;
+				dev->video.edid_size = default_edid_size;
+				pr_err("Using default/backup EDID\n");
+			}
+		}
+	}
+
+	/* If we've got modes, let's pick a best default mode */
+	if (info->monspecs.modedb_len > 0) {
+
+		for (i = 0; i < info->monspecs.modedb_len; i++) {
+			if (dlfb_is_valid_mode(&info->monspecs.modedb[i], info))
+				fb_add_videomode(&info->monspecs.modedb[i],
+					&info->modelist);
+			else {
+				if (i == 0)
+					/* if we've removed top/best mode */
+					info->monspecs.misc
+						&= ~FB_MISC_1ST_DETAIL;
+			}
+		}
+
+		default_vmode = fb_find_best_display(&info->monspecs,
+						     &info->modelist);
+	}
+
+#ifdef CONFIG_FB_MODE_HELPERS
+	/* If everything else has failed, fall back to safe default mode */
+	if (default_vmode == NULL) {
+
+		struct fb_videomode fb_vmode = {0};
+
+		/*
+		 * Add the standard VESA modes to our modelist
+		 * Since we don't have EDID, there may be modes that
+		 * overspec monitor and/or are incorrect aspect ratio, etc.
+		 * But at least the user has a chance to choose
+		 */
+		for (i = 0; i < VESA_MODEDB_SIZE; i++) {
+			if (dlfb_is_valid_mode((struct fb_videomode *)
+						&vesa_modes[i], info))
+				fb_add_videomode(&vesa_modes[i],
+						 &info->modelist);
+		}
+
+		/*
+		 * default to resolution safe for projectors
+		 * (since they are most common case without EDID)
+		 */
+		//fb_vmode.xres = 800;
+		//fb_vmode.yres = 600;
+		fb_vmode.xres = 1024;
+		fb_vmode.yres = 768;
+		fb_vmode.refresh = 60;
+		default_vmode = fb_find_nearest_mode(&fb_vmode,
+						     &info->modelist);
+	}
+#endif
+	/* If we have good mode and no active clients*/
+	if ((default_vmode != NULL) && (dev->video.fb_count == 0)) {
+
+		fb_videomode_to_var(&info->var, default_vmode);
+		dlfb_var_color_format(&info->var);
+
+		/*
+		 * with mode size info, we can now alloc our framebuffer.
+		 */
+		memcpy(&info->fix, &dlfb_fix, sizeof(dlfb_fix));
+		info->fix.line_length = info->var.xres *
+			(info->var.bits_per_pixel / 8);
+
+		result = dlfb_realloc_framebuffer(dev, info);
+		if (result == 0)
+			result = dlfb_alloc_damage_tiles(dev, info);
+
+	} else
+		result = -EINVAL;
+
+error:
+	if (edid && (dev->video.edid != edid))
+		kfree(edid);
+
+	if (info->dev)
+		mutex_unlock(&info->lock);
+
+	return result;
+}
+
+static ssize_t metrics_bytes_rendered_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	
+	printk("metrics_bytes_rendered_show called\n");
+	
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			atomic_read(&dev->video.bytes_rendered));
+}
+
+static ssize_t metrics_bytes_identical_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	
+	printk("metrics_bytes_identical_show called\n");
+	
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			atomic_read(&dev->video.bytes_identical));
+}
+
+static ssize_t metrics_bytes_sent_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	
+	printk("metrics_bytes_sent_show called\n");
+	
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			atomic_read(&dev->video.bytes_sent));
+}
+
+static ssize_t metrics_cpu_kcycles_used_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	
+	printk("metrics_cpu_kcycles_used_show called\n");
+	
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+			atomic_read(&dev->video.cpu_kcycles_used));
+}
+
+static ssize_t monitor_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	
+	printk("monitor_show called\n");
+	
+	return snprintf(buf, PAGE_SIZE, "%s-%s\n",
+			fb_info->monspecs.monitor,
+			fb_info->monspecs.serial_no);
+}
+
+static ssize_t edid_show(
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35)
+			struct file *filp,
+#endif
+			struct kobject *kobj, struct bin_attribute *a,
+			char *buf, loff_t off, size_t count) {
+	struct device *fbdev = container_of(kobj, struct device, kobj);
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	
+	printk("edid_show called\n");
+
+	if (dev->video.edid == NULL)
+		return 0;
+
+	if ((off >= dev->video.edid_size) || (count > dev->video.edid_size))
+		return 0;
+
+	if (off + count > dev->video.edid_size)
+		count = dev->video.edid_size - off;
+
+	pr_info("sysfs edid copy %p to %p, %d bytes\n",
+		dev->video.edid, buf, (int) count);
+
+	memcpy(buf, dev->video.edid, count);
+
+	return count;
+}
+
+static ssize_t edid_store(
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35)
+			struct file *filp,
+#endif
+			struct kobject *kobj, struct bin_attribute *a,
+			char *src, loff_t src_off, size_t src_size) {
+	struct device *fbdev = container_of(kobj, struct device, kobj);
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	
+	printk("edid_store called\n");
+
+	/* We only support write of entire EDID at once, no offset*/
+	if ((src_size != EDID_LENGTH) || (src_off != 0))
+		return 0;
+
+	dlfb_setup_modes(dev, fb_info, src, src_size);
+
+	if (dev->video.edid && (memcmp(src, dev->video.edid, src_size) == 0)) {
+		pr_info("sysfs written EDID is new default\n");
+		dlfb_ops_set_par(fb_info);
+		return src_size;
+	} else
+		return 0;
+}
+
+static ssize_t metrics_reset_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	int i;
+	
+	printk("metrics_reset_store called\n");
+
+	atomic_set(&dev->video.bytes_rendered, 0);
+	atomic_set(&dev->video.bytes_identical, 0);
+	atomic_set(&dev->video.bytes_sent, 0);
+	atomic_set(&dev->video.cpu_kcycles_used, 0);
+	for (i = 0; i < DL_TILE_CODECS; i++) {
+		atomic_set(&dev->video.codec_in[i], 0);
+		atomic_set(&dev->video.codec_out[i], 0);
+	}
+	for (i = 0; i < DL_ROW_FILTERS; i++)
+		atomic_set(&dev->video.filter_rows[i], 0);
+
+	return count;
+}
+
+static ssize_t urb_count_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", dev->video.urbs.count);
+}
+
+static ssize_t urb_count_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	int urbs, ret;
+
+	ret = kstrtoint(buf, 10, &urbs);
+	if (ret)
+		return ret;
+	if ((urbs < DL_URB_COUNT_MIN) || (urbs > DL_URB_COUNT_MAX))
+		return -EINVAL;
+
+	ret = dlfb_resize_urb_list(dev, urbs, dev->video.urbs.size);
+
+	return ret ? ret : count;
+}
+
+static ssize_t urb_size_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", (int) dev->video.urbs.size);
+}
+
+static ssize_t urb_size_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	int size, ret;
+
+	ret = kstrtoint(buf, 10, &size);
+	if (ret)
+		return ret;
+
+	ret = dlfb_resize_urb_list(dev, dev->video.urbs.count,
+				   dlfb_transfer_size(dev, size));
+
+	return ret ? ret : count;
+}
+
+static ssize_t urb_autotune_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", dev->video.urbs.autotune);
+}
+
+static ssize_t urb_autotune_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	bool enable;
+	int ret;
+
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	dev->video.urbs.autotune_stamp = jiffies;
+	dev->video.urbs.autotune = enable;
+
+	return count;
+}
+
+/*
+ * Encode the whole framebuffer as batch segments, one per line, storing
+ * pixels one at a time the way a compressing encoder writes its output.
+ * Wraps around in buf, which must hold a line. Returns bytes written.
+ */
+static u64 dlfb_bench_encode(struct dlfb_data *dev, char *buf, size_t size)
+{
+	struct fb_info *info = dev->video.info;
+	const u32 line_length = info->fix.line_length;
+	const int width = info->var.xres;
+	char *cmd = buf;
+	u64 written = 0;
+	int line, i;
+
+	for (line = 0; line < info->var.yres; line++) {
+		const u16 *src = (const u16 *) (info->fix.smem_start +
+						 line_length * line);
+
+		if (buf + size - cmd < SEGMENT_HEADER_BYTES + width * BPP) {
+			written += cmd - buf;
+			cmd = buf;
+		}
+
+		cmd = dlfb_put_varint(cmd, line ? line_length / BPP - width :
+				      0);
+		cmd = dlfb_put_varint(cmd, width);
+		for (i = 0; i < width; i++) {
+			*cmd++ = src[i];
+			*cmd++ = src[i] >> 8;
+		}
+	}
+
+	return written + (cmd - buf);
+}
+
+/*
+ * Compares encode throughput into a coherent buffer and into a cached
+ * one that is synced for the device after each pass, to pick
+ * streaming_dma per platform.
+ */
+static ssize_t buffer_benchmark_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	const size_t size = DL_TRANSFER_MAX;
+	struct device *dma_dev;
+	u64 rate[2] = { 0, 0 };
+	dma_addr_t coherent_dma, cached_dma;
+	char *coherent, *cached;
+	int mode, pass, ret = -ENOMEM;
+
+	if (!atomic_read(&dev->video.usb_active) ||
+	    (fb_info->fix.line_length + SEGMENT_HEADER_BYTES > size))
+		return -ENODEV;
+	dma_dev = dev->usbdev->bus->controller;
+
+	coherent = usb_alloc_coherent(dev->usbdev, size, GFP_KERNEL,
+				      &coherent_dma);
+	cached = kmalloc(size, GFP_KERNEL);
+	if (!coherent || !cached)
+		goto out;
+	cached_dma = dma_map_single(dma_dev, cached, size, DMA_TO_DEVICE);
+	if (dma_mapping_error(dma_dev, cached_dma))
+		goto out;
+
+	for (mode = 0; mode < 2; mode++) {
+		const ktime_t start = ktime_get();
+		u64 bytes = 0;
+		s64 us;
+
+		for (pass = 0; pass < DL_BENCH_PASSES; pass++) {
+			if (!mode) {
+				bytes += dlfb_bench_encode(dev, coherent, size);
+				continue;
+			}
+			dma_sync_single_for_cpu(dma_dev, cached_dma, size,
+						DMA_TO_DEVICE);
+			bytes += dlfb_bench_encode(dev, cached, size);
+			dma_sync_single_for_device(dma_dev, cached_dma, size,
+						   DMA_TO_DEVICE);
+		}
+
+		us = max_t(s64, ktime_us_delta(ktime_get(), start), 1);
+		rate[mode] = div64_u64(bytes * USEC_PER_SEC, us) >> 10;
+	}
+
+	dma_unmap_single(dma_dev, cached_dma, size, DMA_TO_DEVICE);
+	ret = snprintf(buf, PAGE_SIZE, "coherent %llu KB/s\n"
+		       "streaming %llu KB/s\n", rate[0], rate[1]);
+
+out:
+	kfree(cached);
+	if (coherent)
+		usb_free_coherent(dev->usbdev, size, coherent, coherent_dma);
+
+	return ret;
+}
+
+static const char * const dlfb_codec_names[DLFB_CODEC_COUNT] = {
+	[DLFB_CODEC_NONE] = "none",
+	[DLFB_CODEC_RLE] = "rle",
+	[DLFB_CODEC_DELTA] = "delta",
+	[DLFB_CODEC_PALETTE] = "palette",
+	[DLFB_CODEC_LOSSY] = "lossy",
+	[DLFB_CODEC_FILTER] = "filter",
+	[DLFB_CODEC_LZ4] = "lz4",
+};
+
+/* LZ4 buffers, all or none, so lz4_buf says whether LZ4 can be used */
+static int dlfb_alloc_lz4(struct beaglevideo *video)
+{
+#if DLFB_LZ4
+	if (video->lz4_buf)
+		return 0;
+
+	video->lz4_buf = vmalloc(DL_TRANSFER_MAX);
+	video->lz4_wrkmem = vmalloc(LZ4_MEM_COMPRESS);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 11, 0)
+	video->lz4_out = vmalloc(lz4_compressbound(DL_TRANSFER_MAX));
+	if (!video->lz4_out) {
+		vfree(video->lz4_buf);
+		video->lz4_buf = NULL;
+	}
+#endif
+	if (!video->lz4_buf || !video->lz4_wrkmem) {
+		vfree(video->lz4_buf);
+		vfree(video->lz4_wrkmem);
+		vfree(video->lz4_out);
+		video->lz4_buf = NULL;
+		video->lz4_wrkmem = NULL;
+		video->lz4_out = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+/* Huffman staging buffer and table, all or none */
+static int dlfb_alloc_huffman(struct beaglevideo *video)
+{
+	if (video->huff_buf)
+		return 0;
+
+	video->huff_buf = vmalloc(DL_TRANSFER_MAX);
+	video->huff = kmalloc(sizeof(*video->huff), GFP_KERNEL);
+	if (!video->huff_buf || !video->huff) {
+		vfree(video->huff_buf);
+		kfree(video->huff);
+		video->huff_buf = NULL;
+		video->huff = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Scratch buffers a codec needs, allocated the first time it is chosen
+ * and kept until the device goes. Called with render_lock held.
+ */
+static int dlfb_alloc_codec(struct dlfb_data *dev, int codec)
+{
+	struct beaglevideo *video = &dev->video;
+
+	switch (codec) {
+	case DLFB_CODEC_DELTA:
+	case DLFB_CODEC_FILTER:
+	case DLFB_CODEC_AUTO:
+		if (!video->delta_buf)
+			video->delta_buf = kmalloc(DL_DELTA_PIXELS * BPP,
+						   GFP_KERNEL);
+		if (!video->delta_buf)
+			return -ENOMEM;
+		/* auto compresses whole batches too, when it can */
+		if (codec == DLFB_CODEC_AUTO)
+			dlfb_alloc_lz4(video);
+		return 0;
+	case DLFB_CODEC_LZ4:
+		return dlfb_alloc_lz4(video);
+	default:
+		return 0;
+	}
+}
+
+/* Whether codec can be written to the compression attribute */
+static bool dlfb_codec_selectable(int codec)
+{
+	if (!DLFB_LZ4 && (codec == DLFB_CODEC_LZ4))
+		return false;
+	/* only ever per tile, when bandwidth_target is exceeded */
+	return codec != DLFB_CODEC_LOSSY;
+}
+
+static ssize_t compression_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	ssize_t len = 0;
+	int i;
+
+	/* all choices, the active one in brackets */
+	for (i = 0; i < DLFB_CODEC_COUNT; i++) {
+		if (!dlfb_codec_selectable(i))
+			continue;
+		len += snprintf(buf + len, PAGE_SIZE - len,
+				(i == dev->video.codec) ? "[%s] " : "%s ",
+				dlfb_codec_names[i]);
+	}
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+static ssize_t compression_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	struct beaglevideo *video = &dev->video;
+	unsigned long flags;
+	bool repair = false;
+	int i, ret;
+
+	for (i = 0; i < DLFB_CODEC_COUNT; i++) {
+		if (sysfs_streq(buf, dlfb_codec_names[i]))
+			break;
+	}
+	if ((i == DLFB_CODEC_COUNT) || !dlfb_codec_selectable(i))
+		return -EINVAL;
+
+	/* a flush never mixes codecs within a transfer */
+	mutex_lock(&video->render_lock);
+	ret = dlfb_alloc_codec(dev, i);
+	if (!ret && (video->codec != i)) {
+		video->codec = i;
+		/* only auto settles or refines them, send them exact now */
+		if (video->lossy_tiles) {
+			const int tile_count = video->tiles_x * video->tiles_y;
+
+			spin_lock_irqsave(&video->damage_lock, flags);
+			repair = !bitmap_empty(video->lossy_tiles, tile_count);
+			bitmap_or(video->dirty_tiles, video->dirty_tiles,
+				  video->lossy_tiles, tile_count);
+			bitmap_zero(video->lossy_tiles, tile_count);
+			spin_unlock_irqrestore(&video->damage_lock, flags);
+		}
+	}
+	mutex_unlock(&video->render_lock);
+
+	if (repair && atomic_read(&video->usb_active))
+		schedule_delayed_work(&video->damage_work, 0);
+
+	return ret ? ret : count;
+}
+
+static ssize_t metrics_codec_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	struct beaglevideo *video = &dev->video;
+	int tiles[DL_TILE_CODECS] = { 0 };
+	ssize_t len = 0;
+	int i;
+
+	/* tiles on each choice, and what each codec did for them */
+	mutex_lock(&video->render_lock);
+	for (i = 0; i < video->tiles_x * video->tiles_y; i++)
+		tiles[video->tile_stats[i].codec]++;
+	for (i = 0; i < DL_TILE_CODECS; i++)
+		len += snprintf(buf + len, PAGE_SIZE - len,
+				"%s %d tiles %u in %u out %u cycles/KiB\n",
+				dlfb_codec_names[i], tiles[i],
+				atomic_read(&video->codec_in[i]),
+				atomic_read(&video->codec_out[i]),
+				video->auto_cycles[i]);
+	if (video->lz4_buf)
+		len += snprintf(buf + len, PAGE_SIZE - len,
+				"lz4 %u%% of staged bytes\n",
+				video->lz4_ratio * 100 / DL_RATIO_ONE);
+	if (video->entropy)
+		len += snprintf(buf + len, PAGE_SIZE - len,
+				"huffman %u%% of staged bytes\n",
+				video->huff_ratio * 100 / DL_RATIO_ONE);
+	if (video->bandwidth_target || video->progressive)
+		len += snprintf(buf + len, PAGE_SIZE - len,
+				"lossy depth %s, %d tiles to refine\n",
+				(video->lossy_depth == LOSSY_RGB332) ? "rgb332" :
+				(video->lossy_depth == LOSSY_RGB444) ? "rgb444" :
+				"off",
+				bitmap_weight(video->lossy_tiles,
+					      video->tiles_x * video->tiles_y));
+	mutex_unlock(&video->render_lock);
+
+	return len;
+}
+
+/*
+ * The auto codec's choice for every tile, a line per row of tiles:
+ * n(one), r(le), d(elta), p(alette) or f(ilter), in capitals for
+ * tiles updated so often they count as video. l(ossy) marks tiles the
+ * sink has at reduced depth, waiting to settle.
+ */
+static ssize_t metrics_codec_map_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	struct beaglevideo *video = &dev->video;
+	ssize_t len = 0;
+	int tx, ty;
+
+	mutex_lock(&video->render_lock);
+	for (ty = 0; ty < video->tiles_y; ty++) {
+		if (len + video->tiles_x + 1 >= PAGE_SIZE)
+			break;
+		for (tx = 0; tx < video->tiles_x; tx++) {
+			const struct dlfb_tile_stat *st = &video->tile_stats[
+				ty * video->tiles_x + tx];
+			const char c = test_bit(ty * video->tiles_x + tx,
+						video->lossy_tiles) ?
+				dlfb_codec_names[DLFB_CODEC_LOSSY][0] :
+				dlfb_codec_names[st->codec][0];
+
+			buf[len++] = (st->interval < DL_AUTO_HOT_MS) ?
+				toupper(c) : c;
+		}
+		buf[len++] = '\n';
+	}
+	mutex_unlock(&video->render_lock);
+
+	return len;
+}
+
+/*
+ * Segments sent with the filter codec, by the filter each row got:
+ * how often prediction paid, and how often a row was just a copy.
+ */
+static ssize_t metrics_filter_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	atomic_t *rows = dev->video.filter_rows;
+
+	return snprintf(buf, PAGE_SIZE, "none %u sub %u up %u copy %u\n",
+			atomic_read(&rows[ROW_FILTER_NONE]),
+			atomic_read(&rows[ROW_FILTER_SUB]),
+			atomic_read(&rows[ROW_FILTER_UP]),
+			atomic_read(&rows[ROW_FILTER_COPY]));
+}
+
+static ssize_t entropy_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", dev->video.entropy);
+}
+
+/*
+ * Huffman code RLE, delta and mixed batches on top of their own
+ * encoding. It costs a second pass over every transfer, so check
+ * entropy_benchmark against metrics_cpu_kcycles_used first.
+ */
+static ssize_t entropy_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	bool enable;
+	int ret;
+
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&dev->video.render_lock);
+	ret = enable ? dlfb_alloc_huffman(&dev->video) : 0;
+	if (!ret) {
+		dev->video.entropy = enable;
+		dev->video.huff_ratio = DL_RATIO_ONE;
+	}
+	mutex_unlock(&dev->video.render_lock);
+
+	return ret ? ret : count;
+}
+
+/* Huffman code a benchmark chunk, adding up its coded size and time */
+static void dlfb_bench_huffman(struct dlfb_huffman *huff, const char *chunk,
+			       size_t len, char *out, size_t size,
+			       u64 *coded, s64 *us)
+{
+	const ktime_t start = ktime_get();
+	const size_t packed = dlfb_huffman_compress(huff, chunk, len, out,
+						    size);
+
+	*us += ktime_us_delta(ktime_get(), start);
+	*coded += packed ? packed : len;
+}
+
+/*
+ * RLE encodes the framebuffer into transfer sized chunks and Huffman
+ * codes each, as entropy would, timing the two stages apart. Rates
+ * are of framebuffer bytes in, sizes of each stage's output against
+ * its input.
+ */
+static ssize_t entropy_benchmark_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	const size_t size = dev->video.urbs.size;
+	const int width = fb_info->var.xres;
+	struct dlfb_huffman *huff;
+	u64 raw = 0, rle = 0, coded = 0;
+	s64 total_us, huff_us = 0;
+	char *chunk, *out, *cmd;
+	ktime_t start;
+	int pass, line;
+	ssize_t ret;
+
+	huff = kmalloc(sizeof(*huff), GFP_KERNEL);
+	chunk = vmalloc(size);
+	out = vmalloc(size);
+	if (!huff || !chunk || !out) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	start = ktime_get();
+	for (pass = 0; pass < DL_BENCH_PASSES; pass++) {
+		cmd = chunk;
+		for (line = 0; line < fb_info->var.yres; line++) {
+			const u16 *src = (const u16 *) (fb_info->fix.smem_start +
+				fb_info->fix.line_length * line);
+			u32 done = 0, pixels;
+
+			while (done < width) {
+				pixels = width - done;
+				cmd = dlfb_rle_encode(cmd, chunk + size,
+						      src + done, &pixels);
+				done += pixels;
+				if (done == width)
+					break;
+
+				/* chunk full, the rest goes in the next */
+				rle += cmd - chunk;
+				dlfb_bench_huffman(huff, chunk, cmd - chunk,
+						   out, size, &coded, &huff_us);
+				cmd = chunk;
+			}
+			raw += width * BPP;
+		}
+		rle += cmd - chunk;
+		dlfb_bench_huffman(huff, chunk, cmd - chunk, out, size,
+				   &coded, &huff_us);
+	}
+	total_us = ktime_us_delta(ktime_get(), start);
+	huff_us = max_t(s64, huff_us, 1);
+
+	ret = snprintf(buf, PAGE_SIZE, "rle %llu KB/s %llu%%\n"
+		       "huffman %llu KB/s %llu%%\n",
+		       div64_u64(raw * USEC_PER_SEC,
+				 max_t(s64, total_us - huff_us, 1)) >> 10,
+		       div64_u64(rle * 100, max_t(u64, raw, 1)),
+		       div64_u64(raw * USEC_PER_SEC, huff_us) >> 10,
+		       div64_u64(coded * 100, max_t(u64, rle, 1)));
+
+out:
+	kfree(huff);
+	vfree(chunk);
+	vfree(out);
+	return ret;
+}
+
+static ssize_t bandwidth_target_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", dev->video.bandwidth_target);
+}
+
+/*
+ * KiB/s the link should be kept under. Above it, tiles that change
+ * every few frames are sent at reduced depth with the auto codec,
+ * and again at full depth when they stop. 0 turns it off.
+ */
+static ssize_t bandwidth_target_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	unsigned int target;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &target);
+	if (ret)
+		return ret;
+
+	mutex_lock(&dev->video.render_lock);
+	dev->video.bandwidth_target = target;
+	if (!target)
+		dev->video.lossy_depth = 0;
+	mutex_unlock(&dev->video.render_lock);
+
+	return count;
+}
+
+static ssize_t progressive_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", dev->video.progressive);
+}
+
+/*
+ * Send damage over DL_PROGRESSIVE_PERCENT of the screen at RGB332 with
+ * the auto codec, and bring it up to exact a step per idle frame.
+ */
+static ssize_t progressive_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	bool enable;
+	int ret;
+
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&dev->video.render_lock);
+	dev->video.progressive = enable;
+	mutex_unlock(&dev->video.render_lock);
+
+	return count;
+}
+
+static ssize_t encode_threads_show(struct device *fbdev,
+				   struct device_attribute *a, char *buf) {
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", dev->video.encode_threads);
+}
+
+/*
+ * Threads a flush of DL_BAND_MIN_BYTES or more is encoded on, up to
+ * DL_ENCODE_THREADS_MAX. 1 encodes everything serially.
+ */
+static ssize_t encode_threads_store(struct device *fbdev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(fbdev);
+	struct dlfb_data *dev = fb_info->par;
+	int threads, ret;
+
+	ret = kstrtoint(buf, 10, &threads);
+	if (ret)
+		return ret;
+	if ((threads < 1) || (threads > DL_ENCODE_THREADS_MAX))
+		return -EINVAL;
+
+	mutex_lock(&dev->video.render_lock);
+	dev->video.encode_threads = threads;
+	mutex_unlock(&dev->video.render_lock);
+
+	return count;
+}
+
+static struct bin_attribute edid_attr = {
+	.attr.name = "edid",
+	.attr.mode = 0666,
+	.size = EDID_LENGTH,
+	.read = edid_show,
+	.write = edid_store
+};
+
+static struct device_attribute fb_device_attrs[] = {
+	__ATTR_RO(metrics_bytes_rendered),
+	__ATTR_RO(metrics_bytes_identical),
+	__ATTR_RO(metrics_bytes_sent),
+	__ATTR_RO(metrics_cpu_kcycles_used),
+	__ATTR_RO(monitor),
+	__ATTR(metrics_reset, S_IWUSR, NULL, metrics_reset_store),
+	__ATTR(urb_count, S_IRUGO | S_IWUSR, urb_count_show, urb_count_store),
+	__ATTR(urb_size, S_IRUGO | S_IWUSR, urb_size_show, urb_size_store),
+	__ATTR(urb_autotune, S_IRUGO | S_IWUSR, urb_autotune_show,
+	       urb_autotune_store),
+	__ATTR(buffer_benchmark, S_IRUSR, buffer_benchmark_show, NULL),
+	__ATTR(compression, S_IRUGO | S_IWUSR, compression_show,
+	       compression_store),
+	__ATTR_RO(metrics_codec),
+	__ATTR_RO(metrics_codec_map),
+	__ATTR_RO(metrics_filter),
+	__ATTR(entropy, S_IRUGO | S_IWUSR, entropy_show, entropy_store),
+	__ATTR(entropy_benchmark, S_IRUSR, entropy_benchmark_show, NULL),
+	__ATTR(bandwidth_target, S_IRUGO | S_IWUSR, bandwidth_target_show,
+	       bandwidth_target_store),
+	__ATTR(progressive, S_IRUGO | S_IWUSR, progressive_show,
+	       progressive_store),
+	__ATTR(encode_threads, S_IRUGO | S_IWUSR, encode_threads_show,
+	       encode_threads_store),
+};
+
+/*
+ * This is necessary before we can communicate with the display controller.
+ */
+static int dlfb_select_std_channel(struct dlfb_data *dev)
+{
+	int ret;
+	u8 set_def_chn[] = {	   0x57, 0xCD, 0xDC, 0xA7,
+				0x1C, 0x88, 0x5E, 0x15,
+				0x60, 0xFE, 0xC6, 0x97,
+				0x16, 0x3D, 0x47, 0xF2  };
+
+	printk("dlfb_select_std_channel called\n");
+
+	ret = usb_control_msg(dev->usbdev, usb_sndctrlpipe(dev->usbdev, 0),
+			NR_USB_REQUEST_CHANNEL,
+			(USB_DIR_OUT | USB_TYPE_VENDOR), 0, 0,
+			set_def_chn, sizeof(set_def_chn), USB_CTRL_SET_TIMEOUT);
+	return ret;
+}
+
+static int dlfb_parse_vendor_descriptor(struct dlfb_data *dev,
+					struct usb_interface *interface)
+{
+	char *desc;
+	char *buf;
+	char *desc_end;
+
+	int total_len = 0;
+	
+	printk("dlfb_parse_vendor_descriptor called\n");
+
+	buf = kzalloc(MAX_VENDOR_DESCRIPTOR_SIZE, GFP_KERNEL);
+	if (!buf)
+		return false;
+	desc = buf;
+
+	total_len = usb_get_descriptor(interface_to_usbdev(interface),
+					0x5f, /* vendor specific */
+					0, desc, MAX_VENDOR_DESCRIPTOR_SIZE);
+
+	/* if not found, look in configuration descriptor */
+	if (total_len < 0) {
+		if (0 == usb_get_extra_descriptor(interface->cur_altsetting,
+			0x5f, &desc))
+			total_len = (int) desc[0];
+	}
+
+	if (total_len > 5) {
+		pr_info("vendor descriptor length:%x data:%02x %02x %02x %02x" \
+			"%02x %02x %02x %02x %02x %02x %02x\n",
+			total_len, desc[0],
+			desc[1], desc[2], desc[3], desc[4], desc[5], desc[6],
+			desc[7], desc[8], desc[9], desc[10]);
+
+		if ((desc[0] != total_len) || /* descriptor length */
+		    (desc[1] != 0x5f) ||   /* vendor descriptor type */
+		    (desc[2] != 0x01) ||   /* version (2 bytes) */
+		    (desc[3] != 0x00) ||
+		    (desc[4] != total_len - 2)) /* length after type */
+			goto unrecognized;
+
+		desc_end = desc + total_len;
+		desc += 5; /* the fixed header we've already parsed */
+
+		while (desc < desc_end) {
+			u8 length;
+			u16 key;
+
+			key = le16_to_cpu(*((u16 *) desc));
+			desc += sizeof(u16);
+			length = *desc;
+			desc++;
+
+			switch (key) {
+			case 0x0200: { /* max_area */
+				u32 max_area;
+				max_area = le32_to_cpu(*((u32 *)desc));
+				pr_warn("DL chip limited to %d pixel modes\n",
+					max_area);
+				dev->video.sku_pixel_limit = max_area;
+				break;
+			}
+			default:
+				break;
+			}
+			desc += length;
+		}
+	} else {
+		pr_info("vendor descriptor not available (%d)\n", total_len);
+	}
+
+	goto success;
+
+unrecognized:
+	/* allow udlfb to load for now even if firmware unrecognized */
+	pr_err("Unrecognized vendor firmware descriptor\n");
+
+success:
+	kfree(buf);
+	return true;
+}
+
+static void dlfb_init_framebuffer_work(struct work_struct *work);
+
+
+static void
+set_bulk_address (
+	struct dlfb_data *dev,
+	struct usb_interface *interface)
+{
+	struct usb_endpoint_descriptor *endpoint;
+	struct usb_host_interface *iface_desc;
+	int i;
+	
+	iface_desc = interface->cur_altsetting;
+	for (i = 0; i < iface_desc->desc.bNumEndpoints; ++i) {
+		endpoint = &iface_desc->endpoint[i].desc;
+		
+		/* check for bulk endpoint */
+		if ((endpoint->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) 
+			== USB_ENDPOINT_XFER_BULK){
+			
+			/* bulk in */
+			if(endpoint->bEndpointAddress & USB_DIR_IN) {
+				dev->bulk_in_endpointAddr = endpoint->bEndpointAddress;
+				dev->bulk_in_size = endpoint->wMaxPacketSize;
+				dev->video.bulk_in_buffer = kmalloc(dev->bulk_in_size,
+							 	GFP_KERNEL);
+				if (!dev->video.bulk_in_buffer)
+					printk("Could not allocate bulk buffer");
+			}
+			
+			/* bulk out */
+			else {
+				dev->bulk_out_endpointAddr = endpoint->bEndpointAddress;
+				dev->bulk_out_size =
+					le16_to_cpu(endpoint->wMaxPacketSize);
+			}
+		}
+	}
+}
+
+/*
+ * Transfers that fill whole packets leave no short packet to pad, so
+ * round the urb size down to a multiple of the bulk OUT packet size.
+ */
+static size_t dlfb_transfer_size(struct dlfb_data *dev, int size)
+{
+	const int packet = dev->bulk_out_size ? dev->bulk_out_size : BULK_SIZE;
+
+	size = clamp_t(int, size, DL_TRANSFER_MIN, DL_TRANSFER_MAX);
+	return rounddown(size, packet);
+}
+
+static int dlfb_video_init(struct dlfb_data *dev){
+
+	dev->video.sku_pixel_limit = 2048 * 1152; /* default to maximum */
+
+	if (pixel_limit) {
+		pr_warn("DL chip limit of %d overriden"
+			" by module param to %d\n",
+			dev->video.sku_pixel_limit, pixel_limit);
+		dev->video.sku_pixel_limit = pixel_limit;
+	}
+
+
+	if (!dlfb_alloc_urb_list(dev, WRITES_IN_FLIGHT,
+				 dlfb_transfer_size(dev, transfer_size))) {
+		//retval = -ENOMEM;
+		pr_err("dlfb_alloc_urb_list failed\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int dlfb_usb_probe(struct usb_interface *interface,
+			const struct usb_device_id *id)
+{
+	struct usb_device *usbdev;
+	struct dlfb_data *dev = 0;
+	int retval = -ENOMEM;
+	int i;
+
+	#ifdef CONFIG_FB_DEFERRED_IO
+	printk("Kernel has FB_DEFERRED_IO support\n");
+	#endif
+	
+	#ifdef CONFIG_FB_SYS_IMAGEBLIT
+	printk("Kernel has FB_SYS_IMAGEBLIT support\n");
+	#endif
+
+	#ifdef CONFIG_FB_SYS_FOPS
+	printk("Kernel has FB_SYS_FOPS support\n");
+	#endif
+
+	#ifdef CONFIG_FB_MODE_HELPERS
+	printk("Kernel has FB_MODE_HELPERS support\n");
+	#endif
+
+	printk("dlfb_usb_probe called\n");
+
+	/* usb initialization */
+
+	usbdev = interface_to_usbdev(interface);
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (dev == NULL) {
+		err("dlfb_usb_probe: failed alloc of dev struct\n");
+		goto error;
+	}
+
+	kref_init(&dev->kref); /* matching kref_put in usb .disconnect fn */
+
+	spin_lock_init(&dev->video.urbs.lock);
+	INIT_LIST_HEAD(&dev->video.urbs.list);
+	sema_init(&dev->video.urbs.limit_sem, 0);
+
+	/* before any error path, dlfb_free() cancels damage_work */
+	spin_lock_init(&dev->video.damage_lock);
+	mutex_init(&dev->video.render_lock);
+	INIT_DELAYED_WORK(&dev->video.damage_work, dlfb_damage_work);
+	for (i = 0; i < DL_ENCODE_THREADS_MAX; i++) {
+		dev->video.bands[i].dev = dev;
+		INIT_WORK(&dev->video.bands[i].work, dlfb_encode_band);
+	}
+	dev->video.encode_threads = min_t(int, num_online_cpus(),
+					  DL_ENCODE_THREADS_MAX);
+
+	dev->usbdev = usbdev;
+	dev->dev = &usbdev->dev; /* our generic struct device * */
+	usb_set_intfdata(interface, dev);
+	set_bulk_address(dev, interface);
+
+	/* the command header is a short sg element, so any length must do */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 13, 0)
+	dev->video.sg_capable = usbdev->bus->no_sg_constraint &&
+		(usbdev->bus->sg_tablesize >= DL_SG_ENTRIES);
+#endif
+	pr_info("zero-copy transfers %s\n",
+		dev->video.sg_capable ? "supported" : "not supported by hcd");
+
+	pr_info("%s %s - serial #%s\n",
+		usbdev->manufacturer, usbdev->product, usbdev->serial);
+	pr_info("vid_%04x&pid_%04x&rev_%04x driver's dlfb_data struct at %p\n",
+		usbdev->descriptor.idVendor, usbdev->descriptor.idProduct,
+		usbdev->descriptor.bcdDevice, dev);
+	pr_info("console enable=%d\n", console);
+	pr_info("fb_defio enable=%d\n", fb_defio);
+	pr_info("shadow enable=%d\n", shadow);
+
+
+	if (!dlfb_parse_vendor_descriptor(dev, interface)) {
+		pr_err("firmware not recognized. Assume incompatible device\n");
+		goto error;
+	}
+
+
+	if (dlfb_video_init(dev)){
+		retval = -ENOMEM;
+		goto error;
+	}
+
+
+
+	kref_get(&dev->kref); /* matching kref_put in free_framebuffer_work */
+
+	/* We don't register a new USB class. Our client interface is fbdev */
+
+	/* Workitem keep things fast & simple during USB enumeration */
+	INIT_DELAYED_WORK(&dev->init_framebuffer_work,
+			  dlfb_init_framebuffer_work);
+	schedule_delayed_work(&dev->init_framebuffer_work, 0);
+
+	return 0;
+
+error:
+	if (dev) {
+
+		kref_put(&dev->kref, dlfb_free); /* ref for framebuffer */
+		kref_put(&dev->kref, dlfb_free); /* last ref from kref_init */
+
+		/* dev has been deallocated. Do not dereference */
+	}
+
+	return retval;
+}
+
+static void dlfb_init_framebuffer_work(struct work_struct *work)
+{
+	struct dlfb_data *dev = container_of(work, struct dlfb_data,
+					     init_framebuffer_work.work);
+	struct fb_info *info;
+	int retval;
+	int i;
+
+	printk("dlfb_init_framebuffer_work called\n");
+
+	/* allocates framebuffer driver structure, not framebuffer memory */
+	info = framebuffer_alloc(0, dev->dev);
+	if (!info) {
+		retval = -ENOMEM;
+		pr_err("framebuffer_alloc failed\n");
+		goto error;
+	}
+
+	dev->video.info = info;
+	info->par = dev;
+	info->pseudo_palette = dev->video.pseudo_palette;
+	info->fbops = &dlfb_ops;
+
+	retval = fb_alloc_cmap(&info->cmap, 256, 0);
+	if (retval < 0) {
+		pr_err("fb_alloc_cmap failed %x\n", retval);
+		goto error;
+	}
+
+	INIT_DELAYED_WORK(&dev->free_framebuffer_work,
+			  dlfb_free_framebuffer_work);
+
+	INIT_LIST_HEAD(&info->modelist);
+
+	retval = dlfb_setup_modes(dev, info, NULL, 0);
+	if (retval != 0) {
+		pr_err("unable to find common mode for display and adapter\n");
+		goto error;
+	}
+
+	/* ready to begin using device */
+
+	atomic_set(&dev->video.usb_active, 1);
+	dlfb_select_std_channel(dev);
+
+	dlfb_ops_check_var(&info->var, info);
+	dlfb_ops_set_par(info);
+	
+	/* -TODO- No debug messages here after */
+
+	retval = register_framebuffer(info);
+	printk("Registering framebuffer\n");
+	if (retval < 0) {
+		pr_err("register_framebuffer failed %d\n", retval);
+		goto error;
+	} else{
+		printk("Frame buffer registered\n");
+	}
+	printk("Registering framebuffer done\n");
+
+	for (i = 0; i < ARRAY_SIZE(fb_device_attrs); i++) {
+		retval = device_create_file(info->dev, &fb_device_attrs[i]);
+		if (retval) {
+			pr_warn("device_create_file failed %d\n", retval);
+		} else{
+			printk("device_create_file success!\n");
+		}
+	}
+
+	retval = device_create_bin_file(info->dev, &edid_attr);
+	if (retval) {
+		pr_warn("device_create_bin_file failed %d\n", retval);
+	} else{
+		printk("device_create_bin_file success\n");
+	}
+
+	pr_info("DisplayLink USB device /dev/fb%d attached. %dx%d resolution."
+			" Using %dK framebuffer memory\n", info->node,
+			info->var.xres, info->var.yres,
+			((dev->video.backing_buffer) ?
+			info->fix.smem_len * 2 : info->fix.smem_len) >> 10);
+	return;
+
+error:
+	dlfb_free_framebuffer(dev);
+}
+
+static void dlfb_usb_disconnect(struct usb_interface *interface)
+{
+	struct dlfb_data *dev;
+	struct fb_info *info;
+	int i;
+	
+	printk("dlfb_usb_disconnect called\n");
+
+	dev = usb_get_intfdata(interface);
+	info = dev->video.info;
+
+	pr_info("USB disconnect starting\n");
+
+	/* we virtualize until all fb clients release. Then we free */
+	dev->video.virtualized = true;
+
+	/* When non-active we'll update virtual framebuffer, but no new urbs */
+	atomic_set(&dev->video.usb_active, 0);
+
+	/* this function will wait for all in-flight urbs to complete */
+	/* -TODO- Free these urbs.
+	 * temporarily removed to see if this fixes the disconnect freeze issue
+	 */
+	
+	//dlfb_free_urb_list(dev);
+
+	if (info) {
+
+		/* remove udlfb's sysfs interfaces */
+		for (i = 0; i < ARRAY_SIZE(fb_device_attrs); i++)
+			device_remove_file(info->dev, &fb_device_attrs[i]);
+		device_remove_bin_file(info->dev, &edid_attr);
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 3, 0))
+		unlink_framebuffer(info);
+#endif
+	}
+
+	usb_set_intfdata(interface, NULL);
+	dev->usbdev = NULL;
+	dev->dev = NULL;
+
+	/* if clients still have us open, will be freed on last close */
+	if (dev->video.fb_count == 0)
+		schedule_delayed_work(&dev->free_framebuffer_work, 0);
+
+	/* release reference taken by kref_init in probe() */
+	kref_put(&dev->kref, dlfb_free);
+
+	/* consider dlfb_data freed */
+
+	return;
+}
+
+static struct usb_driver dlfb_driver = {
+	.name = "udlfb",
+	.probe = dlfb_usb_probe,
+	.disconnect = dlfb_usb_disconnect,
+	.id_table = id_table,
+};
+
+static int __init dlfb_module_init(void)
+{
+	int res;
+
+	/* without it every flush is encoded serially */
+	dlfb_encode_wq = alloc_workqueue("udlfb_encode", WQ_UNBOUND,
+					 DL_ENCODE_THREADS_MAX);
+
+	res = usb_register(&dlfb_driver);
+	if (res) {
+		//err("usb_register failed. Error number %d", res);
+		err("usb_register failed. Error number");
+		if (dlfb_encode_wq)
+			destroy_workqueue(dlfb_encode_wq);
+	}
+
+	return res;
+}
+
+static void __exit dlfb_module_exit(void)
+{
+
+	printk("dlfb_module_exit called\n");
+	
+	if(&dlfb_driver)
+		usb_deregister(&dlfb_driver);
+
+	if (dlfb_encode_wq)
+		destroy_workqueue(dlfb_encode_wq);
+}
+
+module_init(dlfb_module_init);
+module_exit(dlfb_module_exit);
+
+/*
+ * Link statistics for autotuning, called with urbs.lock held.
+ * Urbs on the bulk endpoint complete in order, so a transfer was on the
+ * wire from when it was submitted or the previous one completed,
+ * whichever is later. That time is its service time; its round trip is
+ * submit to completion.
+ */
+static void dlfb_urb_account(struct urb_list *urbs, struct urb_node *unode,
+			     u32 bytes)
+{
+	const ktime_t now = ktime_get();
+	const ktime_t start = ktime_to_ns(unode->submit_time) >
+		ktime_to_ns(urbs->last_complete) ?
+		unode->submit_time : urbs->last_complete;
+	const u32 round_trip = ktime_us_delta(now, unode->submit_time);
+
+	urbs->stat_bytes += bytes;
+	urbs->stat_busy_us += ktime_us_delta(now, start);
+	urbs->stat_transfers++;
+	if (!urbs->stat_min_rtt_us || (round_trip < urbs->stat_min_rtt_us))
+		urbs->stat_min_rtt_us = max_t(u32, round_trip, 1);
+	urbs->last_complete = now;
+}
+
+/*
+ * A transfer failed. Mark what it carried for resend, or the whole
+ * screen if it didn't say, and flush again after a frame interval.
+ */
+static void dlfb_urb_lost(struct dlfb_data *dev, struct urb_node *unode)
+{
+	int i;
+
+	if (!unode->area_count)
+		atomic_set(&dev->video.lost_pixels, 1);
+
+	for (i = 0; i < unode->area_count; i++)
+		dlfb_mark_damage(dev, unode->areas[i].x, unode->areas[i].y,
+				 unode->areas[i].w, unode->areas[i].h, true);
+	unode->area_count = 0;
+
+	if (atomic_read(&dev->video.usb_active))
+		schedule_delayed_work(&dev->video.damage_work,
+				      DL_FRAME_INTERVAL);
+}
+
+static void dlfb_urb_completion(struct urb *urb)
+{
+	struct urb_node *unode = urb->context;
+	struct dlfb_data *dev = unode->dev;
+	unsigned long flags;
+
+	/* sync/async unlink faults aren't errors */
+	if (urb->status) {
+		if (!(urb->status == -ENOENT ||
+		    urb->status == -ECONNRESET ||
+		    urb->status == -ESHUTDOWN)) {
+			pr_err("%s - nonzero write bulk status received: %d\n",
+				__func__, urb->status);
+			dlfb_urb_lost(dev, unode);
+		}
+	}
+
+	if (dev->video.urbs.streaming && !urb->num_sgs)
+		dma_sync_single_for_cpu(dev->video.urbs.dma_dev,
+					urb->transfer_dma,
+					urb->transfer_buffer_length,
+					DMA_TO_DEVICE);
+	urb->transfer_buffer_length = dev->video.urbs.size; /* reset to actual */
+	if (urb->num_sgs) {
+		urb->sg = NULL;
+		urb->num_sgs = 0;
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+
+	spin_lock_irqsave(&dev->video.urbs.lock, flags);
+	if (!urb->status && urb->actual_length)
+		dlfb_urb_account(&dev->video.urbs, unode, urb->actual_length);
+	list_add_tail(&unode->entry, &dev->video.urbs.list);
+	dev->video.urbs.available++;
+	spin_unlock_irqrestore(&dev->video.urbs.lock, flags);
+
+	/*
+	 * When using fb_defio, we deadlock if up() is called
+	 * while another is waiting. So queue to another process.
+	 */
+	if (fb_defio)
+		schedule_delayed_work(&unode->release_urb_work, 0);
+	else
+		dlfb_urb_returned(dev);
+}
+
+/*
+ * An urb is free again. If a flush ran out of them, run it again now to
+ * send whatever is pending.
+ */
+static void dlfb_urb_returned(struct dlfb_data *dev)
+{
+	up(&dev->video.urbs.limit_sem);
+	if (atomic_xchg(&dev->video.congested, 0) &&
+	    atomic_read(&dev->video.usb_active))
+		schedule_delayed_work(&dev->video.damage_work, 0);
+}
+
+static void dlfb_free_urb_node(struct dlfb_data *dev, struct urb_node *unode)
+{
+	struct urb *urb = unode->urb;
+
+	/* its up() has been taken, but the work may still be returning */
+	cancel_delayed_work_sync(&unode->release_urb_work);
+
+	/* Free each separately allocated piece */
+	if (dev->video.urbs.streaming) {
+		dma_unmap_single(dev->video.urbs.dma_dev, urb->transfer_dma,
+				 dev->video.urbs.size, DMA_TO_DEVICE);
+		kfree(urb->transfer_buffer);
+	} else
+		usb_free_coherent(urb->dev, dev->video.urbs.size,
+				  urb->transfer_buffer, urb->transfer_dma);
+	usb_free_urb(urb);
+	kfree(unode);
+}
+
+static void dlfb_free_urb_list(struct dlfb_data *dev)
+{
+	int count = dev->video.urbs.count;
+	struct list_head *node;
+	int ret;
+	unsigned long flags;
+	
+	printk("dlfb_free_urb_list called\n");
+
+	pr_notice("Freeing all render urbs\n");
+
+	/* keep waiting and freeing, until we've got 'em all */
+	while (count--) {
+
+		/* Getting interrupted means a leak, but ok at disconnect */
+		ret = down_interruptible(&dev->video.urbs.limit_sem);
+		if (ret)
+			break;
+
+		spin_lock_irqsave(&dev->video.urbs.lock, flags);
+
+		node = dev->video.urbs.list.next; /* have reserved one with sem */
+		list_del_init(node);
+
+		spin_unlock_irqrestore(&dev->video.urbs.lock, flags);
+
+		dlfb_free_urb_node(dev, list_entry(node, struct urb_node,
+						   entry));
+	}
+
+	dev->video.urbs.count = 0;
+}
+
+/*
+ * Take every urb out of circulation, waiting for the ones in flight to
+ * complete. Nothing is then reading memory an sg urb pointed at.
+ */
+static int dlfb_hold_urbs(struct dlfb_data *dev)
+{
+	struct urb_list *urbs = &dev->video.urbs;
+	int held = 0;
+
+	while (held < urbs->count) {
+		if (down_timeout(&urbs->limit_sem, FREE_URB_TIMEOUT))
+			break;
+		held++;
+	}
+	if (held < urbs->count) {
+		while (held--)
+			up(&urbs->limit_sem);
+		return -EBUSY;
+	}
+
+	return 0;
+}
+
+static void dlfb_unhold_urbs(struct dlfb_data *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->video.urbs.count; i++)
+		up(&dev->video.urbs.limit_sem);
+}
+
+/*
+ * Swap the urb pool for one of a different depth and buffer size.
+ * Waits for every urb in flight to complete, so it must not be called
+ * while holding one. If the new pool can't be allocated, the default
+ * one is put back so rendering keeps working.
+ */
+static int dlfb_resize_urb_list(struct dlfb_data *dev, int count, size_t size)
+{
+	struct urb_list *urbs = &dev->video.urbs;
+	struct urb_node *unode;
+	unsigned long flags;
+	int ret = 0;
+
+	mutex_lock(&dev->video.render_lock);
+
+	if (!atomic_read(&dev->video.usb_active)) {
+		ret = -ENODEV;
+		goto unlock;
+	}
+	if ((count == urbs->count) && (size == urbs->size) &&
+	    (streaming_dma == urbs->streaming))
+		goto unlock;
+
+	ret = dlfb_hold_urbs(dev);
+	if (ret)
+		goto unlock;
+
+	spin_lock_irqsave(&urbs->lock, flags);
+	while (!list_empty(&urbs->list)) {
+		unode = list_first_entry(&urbs->list, struct urb_node, entry);
+		list_del_init(&unode->entry);
+		spin_unlock_irqrestore(&urbs->lock, flags);
+		dlfb_free_urb_node(dev, unode);
+		spin_lock_irqsave(&urbs->lock, flags);
+	}
+	urbs->count = 0;
+	urbs->available = 0;
+	spin_unlock_irqrestore(&urbs->lock, flags);
+
+	if (!dlfb_alloc_urb_list(dev, count, size)) {
+		dlfb_alloc_urb_list(dev, WRITES_IN_FLIGHT,
+				    dlfb_transfer_size(dev, transfer_size));
+		ret = -ENOMEM;
+	}
+
+unlock:
+	mutex_unlock(&dev->video.render_lock);
+	return ret;
+}
+
+/*
+ * Coherent memory is uncached on many ARM boards, which makes encoders
+ * that write it a byte at a time crawl. Streaming buffers are ordinary
+ * cached memory, mapped once here and synced for the device at submit.
+ */
+static void *dlfb_alloc_urb_buffer(struct dlfb_data *dev, size_t size,
+				   dma_addr_t *dma)
+{
+	void *buf;
+
+	if (!dev->video.urbs.streaming)
+		return usb_alloc_coherent(dev->usbdev, size, GFP_KERNEL, dma);
+
+	buf = kmalloc(size, GFP_KERNEL);
+	if (!buf)
+		return NULL;
+
+	*dma = dma_map_single(dev->video.urbs.dma_dev, buf, size,
+			      DMA_TO_DEVICE);
+	if (dma_mapping_error(dev->video.urbs.dma_dev, *dma)) {
+		kfree(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static int dlfb_alloc_urb_list(struct dlfb_data *dev, int count, size_t size)
+{
+	int i = 0;
+	struct urb *urb;
+	struct urb_node *unode;
+	char *buf;
+	unsigned long flags;
+	
+	printk("dlfb_alloc_urb_list called\n");
+
+	dev->video.urbs.size = size;
+	dev->video.urbs.streaming = streaming_dma;
+	dev->video.urbs.dma_dev = dev->usbdev->bus->controller;
+
+	while (i < count) {
+		unode = kzalloc(sizeof(struct urb_node), GFP_KERNEL);
+		if (!unode)
+			break;
+		unode->dev = dev;
+
+		INIT_DELAYED_WORK(&unode->release_urb_work,
+			  dlfb_release_urb_work);
+
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb) {
+			kfree(unode);
+			break;
+		}
+		unode->urb = urb;
+
+		buf = dlfb_alloc_urb_buffer(dev, size, &urb->transfer_dma);
+		if (!buf) {
+			kfree(unode);
+			usb_free_urb(urb);
+			break;
+		}
+
+		// -TODO- Remove hardcoded bulkout address
+		/* urb->transfer_buffer_length set to actual before submit */
+		/*  */
+		usb_fill_bulk_urb(urb, dev->usbdev, 
+			usb_sndbulkpipe(dev->usbdev, dev->bulk_out_endpointAddr),
+			buf, size, dlfb_urb_completion, unode);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+		/* full-packet batches still need the sink to see them end */
+		urb->transfer_flags |= URB_ZERO_PACKET;
+
+		spin_lock_irqsave(&dev->video.urbs.lock, flags);
+		list_add_tail(&unode->entry, &dev->video.urbs.list);
+		dev->video.urbs.count++;
+		dev->video.urbs.available++;
+		spin_unlock_irqrestore(&dev->video.urbs.lock, flags);
+
+		up(&dev->video.urbs.limit_sem);
+		i++;
+	}
+
+	pr_notice("allocated %d %d byte %s urbs\n", i, (int) size,
+		  streaming_dma ? "streaming" : "coherent");
+
+	return i;
+}
+
+/* Pop a free urb, after one has been reserved with limit_sem */
+static struct urb *dlfb_take_urb(struct dlfb_data *dev)
+{
+	struct list_head *entry;
+	struct urb_node *unode;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->video.urbs.lock, flags);
+
+	BUG_ON(list_empty(&dev->video.urbs.list)); /* reserved one with limit_sem */
+	entry = dev->video.urbs.list.next;
+	list_del_init(entry);
+	dev->video.urbs.available--;
+
+	spin_unlock_irqrestore(&dev->video.urbs.lock, flags);
+
+	unode = list_entry(entry, struct urb_node, entry);
+	unode->area_count = 0;
+
+	return unode->urb;
+}
+
+static struct urb *dlfb_get_urb(struct dlfb_data *dev)
+{
+	int ret = 0;
+	struct urb *urb = NULL;
+	
+	/* Wait for an in-flight buffer to complete and get re-queued */
+	if (down_trylock(&dev->video.urbs.limit_sem)) {
+		atomic_inc(&dev->video.urbs.waits);
+		ret = down_timeout(&dev->video.urbs.limit_sem,
+				   GET_URB_TIMEOUT);
+	}
+	if (ret) {
+		atomic_set(&dev->video.lost_pixels, 1);
+		pr_warn("wait for urb interrupted: %x available: %d\n",
+		       ret, dev->video.urbs.available);
+		goto error;
+	}
+
+	urb = dlfb_take_urb(dev);
+
+error:
+	return urb;
+}
+
+/*
+ * Take a free urb without waiting. When there is none, the flush is
+ * congested: it leaves the rest of its damage pending, and the next urb
+ * to come back restarts it, so only the newest pixels get queued.
+ */
+static struct urb *dlfb_try_get_urb(struct dlfb_data *dev)
+{
+	if (down_trylock(&dev->video.urbs.limit_sem)) {
+		/* set before retrying, so a racing up() restarts us */
+		atomic_set(&dev->video.congested, 1);
+		smp_mb();
+		if (down_trylock(&dev->video.urbs.limit_sem)) {
+			atomic_inc(&dev->video.urbs.waits);
+			return NULL;
+		}
+		/* not congested after all, nothing to restart */
+		atomic_set(&dev->video.congested, 0);
+	}
+
+	return dlfb_take_urb(dev);
+}
+
+static int dlfb_submit_urb(struct dlfb_data *dev, struct urb *urb, size_t len)
+{
+	int ret;
+
+	BUG_ON(!urb->num_sgs && (len > dev->video.urbs.size));
+
+	urb->transfer_buffer_length = len; /* set to actual payload len */
+	if (dev->video.urbs.streaming && !urb->num_sgs)
+		dma_sync_single_for_device(dev->video.urbs.dma_dev,
+					   urb->transfer_dma, len,
+					   DMA_TO_DEVICE);
+	((struct urb_node *) urb->context)->submit_time = ktime_get();
+	ret = usb_submit_urb(urb, GFP_KERNEL);
+	if (ret) {
+		urb->actual_length = 0;
+		urb->status = ret; /* so what it carried is sent again */
+		dlfb_urb_completion(urb); /* because no one else will */
+		pr_err("usb_submit_urb error %x\n", ret);
+	}
+	return ret;
+}
+
+/*
+ * Return an urb taken with dlfb_get_urb() that ended up not being sent
+ */
+static void dlfb_release_urb(struct dlfb_data *dev, struct urb *urb)
+{
+	struct urb_node *unode = urb->context;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->video.urbs.lock, flags);
+	list_add_tail(&unode->entry, &dev->video.urbs.list);
+	dev->video.urbs.available++;
+	spin_unlock_irqrestore(&dev->video.urbs.lock, flags);
+
+	up(&dev->video.urbs.limit_sem);
+}
+
+module_param(console, bool, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(console, "Allow fbcon to open framebuffer");
+
+module_param(fb_defio, bool, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(fb_defio, "Page fault detection of mmap writes");
+
+module_param(shadow, bool, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(shadow, "Shadow vid mem. Disable to save mem but lose perf");
+
+module_param(pixel_limit, int, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(pixel_limit, "Force limit on max mode (in x*y pixels)");
+
+module_param(tile_size, int, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(tile_size, "Damage tile edge in pixels (power of 2, 8-128)");
+
+module_param(batch, bool, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(batch, "Pack dirty segments into large transfers");
+
+module_param(transfer_size, int, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(transfer_size, "Bytes per bulk transfer (rounded to packets)");
+
+module_param(zero_copy, bool, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(zero_copy, "Scatter-gather full width updates without copying");
+
+module_param(streaming_dma, bool, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP);
+MODULE_PARM_DESC(streaming_dma, "Cacheable urb buffers with streaming DMA (faster encode on ARM)");
+
+MODULE_AUTHOR("Roberto De Ioris <roberto@unbit.it>, "
+	      "Jaya Kumar <jayakumar.lkml@gmail.com>, "
+	      "Bernie Thompson <bernie@plugable.com>");
+MODULE_DESCRIPTION("DisplayLink kernel framebuffer driver");
+MODULE_LICENSE("GPL");
+